@@ -23,7 +23,7 @@
  */
 
 /* Simple DFT — magnitude of first `nbins` harmonics */
-static void dft_mag(const double *x, int n, double *mag, int nbins) {
+static void dft_mag(const ks_real *x, int n, double *mag, int nbins) {
     for (int k = 0; k < nbins; k++) {
         double re = 0.0, im = 0.0;
         for (int i = 0; i < n; i++) {
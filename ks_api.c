@@ -2,7 +2,6 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
-#include <ctype.h>
 #include "ksynth.h"
 
 typedef struct ks_api_state {
@@ -14,98 +13,50 @@ typedef struct ks_api_state {
     char    repl_str[1024];
     float  *var_buf;
     int     var_len;
+    char       *prog_src;  /* text of the cached ks_ctx_run program */
+    ks_program *prog;
     struct ks_api_state *next;
 } ks_api_state;
 
 static ks_api_state *g_states = NULL;
 static ks_api_state *g_default_state = NULL;
 
-static char *ks_api_trim_ws(char *s) {
-    while (*s && isspace((unsigned char)*s)) s++;
-    if (*s == '\0') return s;
-
-    char *end = s + strlen(s) - 1;
-    while (end >= s && isspace((unsigned char)*end)) {
-        *end = '\0';
-        end--;
-    }
-
-    return s;
-}
-
-static int ks_api_eval_segments(ks_api_state *st, const char *code, K *last_result_out) {
+static int ks_api_run_program(ks_api_state *st, ks_program *prog, int incremental,
+                              K *last_result_out) {
     if (last_result_out) *last_result_out = NULL;
-    if (!st || !st->ctx || !code) return -1;
+    if (!st || !st->ctx || !prog) return -1;
 
-    size_t len = strlen(code);
-    char *buf = (char*)malloc(len + 1);
-    if (!buf) {
-        st->ctx->last_status = KS_ERR_OOM;
+    K result = incremental ? ks_program_rerun(st->ctx, prog) : ks_program_run(st->ctx, prog);
+    if (st->ctx->last_status != KS_OK) {
+        if (result) k_free(st->ctx, result);
         return -1;
     }
-    memcpy(buf, code, len + 1);
-
-    int paren_depth = 0;
-    int brace_depth = 0;
-    int bracket_depth = 0;
-    char *segment_start = buf;
-
-    for (char *p = buf; ; p++) {
-        char c = *p;
-
-        if (c == '(') paren_depth++;
-        else if (c == ')' && paren_depth > 0) paren_depth--;
-        else if (c == '{') brace_depth++;
-        else if (c == '}' && brace_depth > 0) brace_depth--;
-        else if (c == '[') bracket_depth++;
-        else if (c == ']' && bracket_depth > 0) bracket_depth--;
-
-        int at_top_level = (paren_depth == 0 && brace_depth == 0 && bracket_depth == 0);
-        int is_boundary = (c == '\0' ||
-                           (at_top_level && (c == ';' || c == '\n' || c == '\r' || c == '/')));
-        if (!is_boundary) continue;
-
-        char saved = c;
-        *p = '\0';
-
-        char *segment = ks_api_trim_ws(segment_start);
-        if (*segment != '\0') {
-            K result = ks_eval(st->ctx, segment, strlen(segment));
-            if (st->ctx->last_status != KS_OK) {
-                if (result) k_free(st->ctx, result);
-                if (last_result_out && *last_result_out) {
-                    k_free(st->ctx, *last_result_out);
-                    *last_result_out = NULL;
-                }
-                free(buf);
-                return -1;
-            }
-
-            if (last_result_out) {
-                if (*last_result_out) k_free(st->ctx, *last_result_out);
-                *last_result_out = result;
-            } else if (result) {
-                k_free(st->ctx, result);
-            }
-        }
-
-        if (saved == '/') {
-            char *comment = p + 1;
-            while (*comment && *comment != '\n') comment++;
-            if (*comment == '\0') break;
-            segment_start = comment + 1;
-            p = comment;
-            continue;
-        }
 
-        if (saved == '\0') break;
-        segment_start = p + 1;
+    if (last_result_out) {
+        *last_result_out = result;
+    } else if (result) {
+        k_free(st->ctx, result);
     }
-
-    free(buf);
     return 0;
 }
 
+/* Scripts passed to ks_ctx_run are usually the same patch re-rendered,
+   so the compiled program is kept until the text changes. */
+static ks_program *ks_api_script_program(ks_api_state *st, const char *script) {
+    if (st->prog && st->prog_src && strcmp(st->prog_src, script) == 0) return st->prog;
+
+    ks_program_free(st->prog);
+    free(st->prog_src);
+    st->prog = ks_compile(script, strlen(script));
+    st->prog_src = st->prog ? strdup(script) : NULL;
+    if (st->prog && !st->prog_src) {
+        ks_program_free(st->prog);
+        st->prog = NULL;
+    }
+    if (!st->prog) st->ctx->last_status = KS_ERR_OOM;
+    return st->prog;
+}
+
 static void ks_api_clear_buffers(ks_api_state *st) {
     if (!st) return;
     free(st->ks_buf);
@@ -154,6 +105,8 @@ static void ks_api_destroy_state(ks_api_state *st) {
         link = &(*link)->next;
     }
     ks_api_clear_buffers(st);
+    ks_program_free(st->prog);
+    free(st->prog_src);
     if (st->ctx) ks_destroy(st->ctx);
     free(st);
 }
@@ -181,11 +134,23 @@ int ks_ctx_run(uintptr_t handle, const char *script) {
     ks_api_state *st = ks_api_find(handle);
     if (!st || !st->ctx) return -1;
 
-    ks_clear_vars(st->ctx);
     ks_api_clear_buffers(st);
-    if (!script) return -1;
+    if (!script) {
+        ks_clear_vars(st->ctx);
+        return -1;
+    }
 
-    if (ks_api_eval_segments(st, script, NULL) != 0) {
+    /* Re-running an edited patch only recomputes the assignments whose
+       text or inputs changed; everything else a fresh run would rebuild
+       identically is kept. */
+    ks_program *prog = ks_api_script_program(st, script);
+    if (!prog) {
+        ks_clear_vars(st->ctx);
+        return -1;
+    }
+    ks_program_clear_vars(st->ctx, prog);
+    ks_seed(st->ctx, st->ctx->rng_seed);   /* same noise every render */
+    if (ks_api_run_program(st, prog, 1, NULL) != 0) {
         return -1;
     }
 
@@ -225,7 +190,11 @@ int ks_ctx_repl(uintptr_t handle, const char *expr) {
     if (!expr || !*expr) return 0;
 
     K result = NULL;
-    if (ks_api_eval_segments(st, expr, &result) != 0) {
+    ks_program *prog = ks_compile(expr, strlen(expr));
+    if (!prog) st->ctx->last_status = KS_ERR_OOM;
+    int rc = ks_api_run_program(st, prog, 0, &result);
+    ks_program_free(prog);
+    if (rc != 0) {
         snprintf(st->repl_str, sizeof(st->repl_str), "Error: %s", ks_strerror(st->ctx->last_status));
         return -1;
     }
@@ -3,11 +3,54 @@
 #include <string.h>
 #include <math.h>
 #include <setjmp.h>
+#include <ctype.h>
 #include "ksynth.h"
 
+/* Virtual memory for the arena (see Arena Memory) */
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#define KS_ARENA_VM 1
+#elif (defined(__unix__) || defined(__APPLE__)) && !defined(__EMSCRIPTEN__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define KS_ARENA_VM 1
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+#else
+#define KS_ARENA_VM 0
+#endif
+
+/* Worker threads (see Worker Threads) */
+#if defined(_WIN32)
+#define KS_THREADS 1
+#elif (defined(__unix__) || defined(__APPLE__)) && \
+      (!defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__))
+#include <pthread.h>
+#define KS_THREADS 1
+#else
+#define KS_THREADS 0
+#endif
+
+/* SIMD for the element-wise kernels (see Dyadic Kernels). The ISA is
+   chosen at build time: -mavx2 or -march=native for AVX, SSE2 is the
+   x86-64 baseline, anything else takes the scalar loops. */
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
 #endif
+#ifndef M_LN2
+#define M_LN2 0.69314718055994530942
+#endif
 
 /* --- Error Strings --- */
 
@@ -36,15 +79,160 @@ const char* ks_strerror(ks_status status) {
     } \
 } while(0)
 
-/* --- Safe Value Helper --- */
+/* --- Safe Value Helper ---
+ * NaN and inf become 0, anything else is held to +-1e6. Written as
+ * selects rather than branches, so a pass over a buffer vectorises. */
 
 static inline double safe_val(double v) {
+    double a = fabs(v), lim = a < INFINITY ? 1e6 : 0.0;
+    return copysign(a < lim ? a : lim, v);
+}
+
+/* safe_val for a value on a recursion's dependency chain. There the
+   selects would add their latency to every step, and let the compiler
+   vectorise a chain that gains nothing from it; branches that are
+   never taken add nothing. */
+static inline double safe_step(double v) {
     if (isnan(v) || isinf(v)) return 0.0;
     if (v > 1e6) return 1e6;
     if (v < -1e6) return -1e6;
     return v;
 }
 
+static void safe_run(ks_real *o, int n) {
+    for (int i = 0; i < n; i++) o[i] = safe_val(o[i]);
+}
+
+/* Samples a recursive verb may run between clamps of its state under
+   the context's NaN policy; 1 clamps inside every step. */
+static int clamp_span(const ks_ctx *ctx, int n) {
+    switch (ctx->nan_policy) {
+    case KS_NAN_BLOCK:  return KS_NAN_BLOCK_LEN;
+    case KS_NAN_OUTPUT: return n > 1 ? n : 1;
+    default:            return 1;
+    }
+}
+
+/* `e` clamps its argument so the result is always finite in ks_real. */
+#ifdef KS_FLOAT32
+#define KS_EXP_MAX 88
+#else
+#define KS_EXP_MAX 100
+#endif
+
+/* --- Arena Memory ---
+ * The arena reserves mem_limit bytes of address space up front and
+ * backs them with memory in KS_ARENA_STEP pieces as the bump pointer
+ * gets there, so a context sized for the worst patch only costs what
+ * its patches actually touch. Where there is no virtual memory API
+ * the whole block is malloc'd and counts as committed from the start. */
+
+#define KS_ARENA_STEP (1u << 20)
+
+static size_t vm_page(void) {
+#if KS_ARENA_VM && defined(_WIN32)
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwAllocationGranularity;
+#elif KS_ARENA_VM
+    long pg = sysconf(_SC_PAGESIZE);
+    return pg > 0 ? (size_t)pg : 4096;
+#else
+    return KS_ARENA_STEP;
+#endif
+}
+
+static size_t vm_round(size_t n) {
+    size_t pg = vm_page();
+    return (n + pg - 1) / pg * pg;
+}
+
+static char *vm_reserve(size_t sz) {
+#if KS_ARENA_VM && defined(_WIN32)
+    return VirtualAlloc(NULL, sz, MEM_RESERVE, PAGE_NOACCESS);
+#elif KS_ARENA_VM
+    void *p = mmap(NULL, sz, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+#else
+    return malloc(sz);
+#endif
+}
+
+static int vm_commit(char *p, size_t sz) {
+#if KS_ARENA_VM && defined(_WIN32)
+    return VirtualAlloc(p, sz, MEM_COMMIT, PAGE_READWRITE) ? 0 : -1;
+#elif KS_ARENA_VM
+    return mprotect(p, sz, PROT_READ | PROT_WRITE);
+#else
+    (void)p; (void)sz;
+    return 0;
+#endif
+}
+
+/* Drop the pages and their contents; the range stays reserved. */
+static void vm_decommit(char *p, size_t sz) {
+#if KS_ARENA_VM && defined(_WIN32)
+    VirtualFree(p, sz, MEM_DECOMMIT);
+#elif KS_ARENA_VM
+    mmap(p, sz, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+#else
+    (void)p; (void)sz;
+#endif
+}
+
+static void vm_release(char *p, size_t sz) {
+#if KS_ARENA_VM && defined(_WIN32)
+    (void)sz;
+    VirtualFree(p, 0, MEM_RELEASE);
+#elif KS_ARENA_VM
+    munmap(p, sz);
+#else
+    (void)sz;
+    free(p);
+#endif
+}
+
+/* Back the arena with memory up to at least `need`. */
+static int arena_commit(ks_ctx *ctx, char *need) {
+    if (need > ctx->arena_end) return -1;
+    size_t want = (size_t)(need - ctx->arena_base);
+    size_t step = want - (size_t)(ctx->arena_commit - ctx->arena_base);
+    if (step < KS_ARENA_STEP) step = KS_ARENA_STEP;
+    size_t top = vm_round((size_t)(ctx->arena_commit - ctx->arena_base) + step);
+    size_t cap = vm_round(ctx->mem_limit);
+    if (top > cap) top = cap;
+    if (vm_commit(ctx->arena_commit, (size_t)(ctx->arena_base + top - ctx->arena_commit)) != 0)
+        return -1;
+    ctx->arena_commit = ctx->arena_base + top;
+    if (top > ctx->arena_peak) ctx->arena_peak = top;
+    return 0;
+}
+
+/* Between evals: give back whatever is committed above the keep size. */
+static void arena_trim(ks_ctx *ctx) {
+    if (ctx->arena_keep == KS_ARENA_KEEP_ALL || !KS_ARENA_VM) return;
+    size_t used = (size_t)(ctx->arena_ptr - ctx->arena_base);
+    size_t keep = vm_round(used > ctx->arena_keep ? used : ctx->arena_keep);
+    if (keep >= (size_t)(ctx->arena_commit - ctx->arena_base)) return;
+    vm_decommit(ctx->arena_base + keep, (size_t)(ctx->arena_commit - ctx->arena_base) - keep);
+    ctx->arena_commit = ctx->arena_base + keep;
+}
+
+void ks_arena_keep(ks_ctx *ctx, size_t bytes) {
+    if (!ctx) return;
+    ctx->arena_keep = bytes;
+    arena_trim(ctx);
+}
+
+void ks_arena_get_stats(const ks_ctx *ctx, ks_arena_stats *out) {
+    if (!out) return;
+    memset(out, 0, sizeof *out);
+    if (!ctx) return;
+    out->reserved  = ctx->mem_limit;
+    out->committed = (size_t)(ctx->arena_commit - ctx->arena_base);
+    out->peak      = ctx->arena_peak;
+}
+
 /* --- Context Lifecycle --- */
 
 ks_ctx* ks_create(size_t mem_limit, long long gas_limit) {
@@ -58,63 +246,206 @@ ks_ctx* ks_create(size_t mem_limit, long long gas_limit) {
        multi-stage patches without being wasteful. */
     if (mem_limit == 0) mem_limit = 8 * 1024 * 1024;
 
-    ctx->arena_base = malloc(mem_limit);
+    ctx->arena_base = vm_reserve(KS_ARENA_VM ? vm_round(mem_limit) : mem_limit);
     if (!ctx->arena_base) { free(ctx); return NULL; }
     ctx->arena_ptr  = ctx->arena_base;
     ctx->arena_end  = ctx->arena_base + mem_limit;
+    ctx->arena_commit = KS_ARENA_VM ? ctx->arena_base : ctx->arena_end;
+    ctx->arena_keep = KS_ARENA_KEEP_ALL;
+    ctx->arena_peak = KS_ARENA_VM ? 0 : mem_limit;
     ctx->mem_limit  = mem_limit;
 
     ctx->gas_limit  = gas_limit;
+    ctx->threads    = 1;
+    ctx->par_min    = KS_PAR_MIN;
+    ctx->control_rate = 1;
     return ctx;
 }
 
+static void helpers_clear_vars(ks_ctx *ctx);
+
 void ks_clear_vars(ks_ctx *ctx) {
     if (!ctx) return;
     for (int i = 0; i < 26; i++) {
         if (ctx->vars[i]) { k_free(ctx, ctx->vars[i]); ctx->vars[i] = NULL; }
+        ctx->gen[i]++;
     }
+    helpers_clear_vars(ctx);
     /* args[] are arena-allocated; just null them out — the arena
        reset in ks_eval handles their memory. */
     ctx->args[0] = ctx->args[1] = NULL;
 }
 
+static void fn_cache_free(ks_ctx *ctx);
+static void memo_free(ks_ctx *ctx);
+static void deps_free(ks_ctx *ctx);
+static void loans_free(ks_ctx *ctx);
+static void pool_free(ks_ctx *ctx);
+static void wt_free(ks_ctx *ctx);
+static void helpers_free(ks_ctx *ctx);
+static void workers_free(ks_ctx *ctx);
+
+/* Remembered values and rerun records were computed in the old mode. */
+void ks_set_accuracy(ks_ctx *ctx, ks_accuracy acc) {
+    if (!ctx || ctx->accuracy == acc) return;
+    ctx->accuracy = acc;
+    memo_free(ctx);
+    deps_free(ctx);
+}
+
+void ks_set_control_rate(ks_ctx *ctx, int k) {
+    if (!ctx) return;
+    if (k < 1) k = 1;
+    if (k > KS_MAX_CONTROL_RATE) k = KS_MAX_CONTROL_RATE;
+    if (ctx->control_rate == k) return;
+    ctx->control_rate = k;
+    memo_free(ctx);
+    deps_free(ctx);
+}
+
+void ks_set_nan_policy(ks_ctx *ctx, ks_nan_policy p) {
+    if (!ctx) return;
+    if (p != KS_NAN_BLOCK && p != KS_NAN_OUTPUT) p = KS_NAN_SAMPLE;
+    if (ctx->nan_policy == p) return;
+    ctx->nan_policy = p;
+    memo_free(ctx);
+    deps_free(ctx);
+}
+
 void ks_destroy(ks_ctx *ctx) {
     if (!ctx) return;
     ks_clear_vars(ctx);
-    free(ctx->arena_base);
+    fn_cache_free(ctx);
+    memo_free(ctx);
+    deps_free(ctx);
+    loans_free(ctx);
+    pool_free(ctx);
+    wt_free(ctx);
+    helpers_free(ctx);
+    workers_free(ctx);
+    free(ctx->sin_tab);
+    vm_release(ctx->arena_base, vm_round(ctx->mem_limit));
     free(ctx);
 }
 
 /* --- K Lifecycle --- */
 
+/* Length marking a pending fused value inside the evaluator (see Fusion),
+   and the element slots it takes to hold the node pointer. */
+#define KS_FUSED -2
+#define KS_FUSED_SLOTS ((int)((sizeof(void *) + sizeof(ks_real) - 1) / sizeof(ks_real)))
+
 /* Alignment for the bump allocator — double is 8 bytes, that's our ceiling. */
 #define KS_ALIGN 8
 #define KS_ALIGN_UP(n) (((n) + (KS_ALIGN-1)) & ~(size_t)(KS_ALIGN-1))
 
 /* Arena-allocated K: lives only for the duration of the current ks_eval call.
-   k_free is a no-op; the arena is reset as a whole in ks_eval. */
-K k_new(ks_ctx *ctx, int n) {
-    if (n < 0) n = 0;
-    size_t sz = KS_ALIGN_UP(sizeof(struct { int r, n; double f[]; }) + sizeof(double) * n);
-
-    if (ctx->arena_ptr + sz > ctx->arena_end) {
+   The arena is reset as a whole in ks_eval; k_free only drops a reference. */
+static void *arena_alloc(ks_ctx *ctx, size_t sz) {
+    sz = KS_ALIGN_UP(sz);
+    if (sz > (size_t)(ctx->arena_commit - ctx->arena_ptr) &&
+        arena_commit(ctx, ctx->arena_ptr + sz) != 0) {
         ctx->last_status = KS_ERR_OOM;
         longjmp(ctx->recover, 1);
     }
-
-    K x = (K)ctx->arena_ptr;
+    void *p = ctx->arena_ptr;
     ctx->arena_ptr += sz;
+    return p;
+}
+
+K k_new(ks_ctx *ctx, int n) {
+    if (n < 0) n = 0;
+    K x = arena_alloc(ctx, sizeof(struct { int r, n; ks_real f[]; }) + sizeof(ks_real) * n);
     x->r = 1; x->n = n;
     return x;
 }
 
-/* Persistent K: malloc'd, survives across ks_eval calls.
-   Used for vars[] (A-Z) only. Freed explicitly by ks_clear_vars/ks_destroy. */
+/* --- Perm Pool ---
+ * Persistent K objects (vars, eval results, bound arrays) come from a
+ * per-context pool. Sizes are rounded up to one of four classes per
+ * power of two, and a freed object goes on its class's free list
+ * instead of back to malloc, so a script that reassigns the same
+ * letters every render settles into doing no system allocation. Each
+ * object sits behind a small header naming its class; objects too big
+ * to pool, or made without a pool, have class -1 and use plain free.
+ * The lists hold at most mem_limit bytes; ks_destroy empties them. */
+
+#define KS_POOL_MIN     8                /* elements in the smallest class */
+#define KS_POOL_OCTAVES 18               /* classes up to 8 << 18 elements */
+#define KS_POOL_CLASSES (1 + 4 * KS_POOL_OCTAVES)
+
+typedef struct ks_perm {
+    struct ks_perm *next;                /* free list link */
+    int cls, pad;
+} ks_perm;
+
+struct ks_pool {
+    ks_perm *free[KS_POOL_CLASSES];
+    size_t cached;                       /* bytes on the free lists */
+};
+
+#define KS_PERM_HDR KS_ALIGN_UP(sizeof(ks_perm))
+#define PERM_OF(x)  ((ks_perm *)((char *)(x) - KS_PERM_HDR))
+
+/* Class for n elements, and its capacity; -1 if too big to pool. */
+static int pool_class(int n, int *cap) {
+    if (n <= KS_POOL_MIN) { *cap = KS_POOL_MIN; return 0; }
+    int o = 3;                                   /* n in (2^o, 2^(o+1)] */
+    while (o < 31 && (n - 1) >> (o + 1)) o++;
+    if (o - 3 >= KS_POOL_OCTAVES) { *cap = n; return -1; }
+    int step = 1 << (o - 2);
+    int k = (n - (1 << o) + step - 1) / step;    /* 1..4 */
+    *cap = (1 << o) + k * step;
+    return 1 + (o - 3) * 4 + (k - 1);
+}
+
+/* Capacity of class cls, the inverse of pool_class. */
+static int pool_cap(int cls) {
+    if (cls == 0) return KS_POOL_MIN;
+    int o = 3 + (cls - 1) / 4, k = (cls - 1) % 4 + 1;
+    return (1 << o) + k * (1 << (o - 2));
+}
+
+static size_t perm_bytes(int cap) {
+    return KS_PERM_HDR + sizeof(struct { int r, n; ks_real f[]; }) + sizeof(ks_real) * (size_t)cap;
+}
+
+static void perm_release(ks_ctx *ctx, K x) {
+    ks_perm *h = PERM_OF(x);
+    struct ks_pool *pl = ctx ? ctx->pool : NULL;
+    if (h->cls < 0 || !pl) { free(h); return; }
+    size_t sz = perm_bytes(pool_cap(h->cls));
+    if (pl->cached + sz > ctx->mem_limit) { free(h); return; }
+    h->next = pl->free[h->cls];
+    pl->free[h->cls] = h;
+    pl->cached += sz;
+}
+
+static void pool_free(ks_ctx *ctx) {
+    struct ks_pool *pl = ctx->pool;
+    if (!pl) return;
+    for (int c = 0; c < KS_POOL_CLASSES; c++)
+        while (pl->free[c]) { ks_perm *h = pl->free[c]; pl->free[c] = h->next; free(h); }
+    free(pl);
+    ctx->pool = NULL;
+}
+
+/* Persistent K: pooled, survives across ks_eval calls. Used for vars[]
+   and values handed to the host; released with k_free. */
 K k_new_perm(ks_ctx *ctx, int n) {
     if (n < 0) n = 0;
-    size_t sz = sizeof(struct { int r, n; double f[]; }) + sizeof(double) * n;
-    K x = malloc(sz);
-    if (!x) {
+    int cap, cls = pool_class(n, &cap);
+    struct ks_pool *pl = ctx->pool;
+    if (!pl && cls >= 0) pl = ctx->pool = calloc(1, sizeof(struct ks_pool));
+    if (!pl) { cls = -1; cap = n; }
+    ks_perm *h = NULL;
+    if (cls >= 0 && (h = pl->free[cls])) {
+        pl->free[cls] = h->next;
+        pl->cached -= perm_bytes(cap);
+    } else {
+        h = malloc(perm_bytes(cap));
+    }
+    if (!h) {
         /* k_new_perm is called both inside ks_eval (from the assignment
            operator) and outside it (from bind_scalar). longjmping to
            ctx->recover when called outside eval is UB — recover hasn't
@@ -123,6 +454,8 @@ K k_new_perm(ks_ctx *ctx, int n) {
         ctx->last_status = KS_ERR_OOM;
         return NULL;
     }
+    h->cls = cls;
+    K x = (K)((char *)h + KS_PERM_HDR);
     x->r = 1; x->n = n;
     return x;
 }
@@ -133,20 +466,41 @@ static int k_is_arena_owned(ks_ctx *ctx, K x) {
            (char *)x <  ctx->arena_end;
 }
 
-/* k_free: arena objects are owned by the arena, so this is a no-op for them.
-   Persistent objects still use refcounts so external users (audio voices,
-   embedders) can hold a variable buffer after its var slot is overwritten. */
+/* k_free: arena objects are refcounted too, so the evaluator knows when
+   a temporary has a single owner (a verb may then write its result into
+   it) and when it is dead. A dead temporary at the top of the arena is
+   popped; the rest is reclaimed when the eval ends. Persistent objects
+   use refcounts so external users (audio voices, embedders) can hold a
+   variable buffer after its var slot is overwritten. */
 void k_free(ks_ctx *ctx, K x) {
     if (!x) return;
-    if (k_is_arena_owned(ctx, x)) return;
-    if (--x->r <= 0) free(x);
+    if (k_is_arena_owned(ctx, x)) {
+        if (--x->r > 0 || x->n == -1) return;
+        int n = (x->n == KS_FUSED) ? KS_FUSED_SLOTS : x->n;
+        char *end = (char *)x + KS_ALIGN_UP(sizeof(struct { int r, n; ks_real f[]; }) + sizeof(ks_real) * n);
+        if (end == ctx->arena_ptr) ctx->arena_ptr = (char *)x;
+        return;
+    }
+    if (--x->r <= 0) perm_release(ctx, x);
+}
+
+/* A verb's result can go straight into an input that is a temporary
+   nobody else holds. The extra reference is dropped by the verb's usual
+   k_free of that input. */
+static int k_unique(ks_ctx *ctx, K b) {
+    return b->r == 1 && b->n >= 0 && k_is_arena_owned(ctx, b);
+}
+
+static K k_reuse(ks_ctx *ctx, K b) {
+    if (k_unique(ctx, b)) { b->r++; return b; }
+    return k_new(ctx, b->n);
 }
 
 K k_view(ks_ctx *ctx, int n, double *ptr) {
     K x = k_new(ctx, n);
     if (x && ptr) {
         GAS_CHECK(ctx, n);
-        memcpy(x->f, ptr, n * sizeof(double));
+        for (int i = 0; i < n; i++) x->f[i] = (ks_real)ptr[i];
     }
     return x;
 }
@@ -165,43 +519,107 @@ ks_status ks_bind_vector(ks_ctx *ctx, char name, const double *values,
 
     K x = k_new_perm(ctx, (int)length);
     if (!x) return KS_ERR_OOM;
-    if (length) memcpy(x->f, values, length * sizeof(double));
+    for (size_t j = 0; j < length; j++) x->f[j] = (ks_real)values[j];
 
     int i = name - 'A';
     K old = ctx->vars[i];
     ctx->vars[i] = x;
+    ctx->gen[i]++;
     k_free(ctx, old);
     ctx->last_status = KS_OK;
     return KS_OK;
 }
 
-/* k_get returns an arena-allocated copy of the var's value.
-   The perm object in vars[] is left untouched; the copy lives for
-   the duration of the current eval. */
+/* k_get returns a reference to the var's buffer itself, not a copy.
+   Treat it as read-only; release it with k_free like any K. It stays
+   valid after the var is overwritten until the last holder lets go. */
 K k_get(ks_ctx *ctx, char name) {
-    if (name < 'A' || name > 'Z' || !ctx->vars[name - 'A']) return NULL;
+    if (!ctx || name < 'A' || name > 'Z' || !ctx->vars[name - 'A']) return NULL;
     K v = ctx->vars[name - 'A'];
-    if (k_is_func(v)) {
-        /* Functions: arena-copy the func object so the body pointer
-           still points into the perm allocation's flex array. */
-        int len = strlen((char*)v->f) + 1;
-        int ndoubles = (len + sizeof(double) - 1) / sizeof(double);
-        K x = k_new(ctx, ndoubles);
-        x->n = -1;
-        memcpy(x->f, v->f, len);
-        return x;
+    v->r++;
+    return v;
+}
+
+/* --- Variable Loans ---
+ * Reading a variable inside an eval hands out the perm buffer itself.
+ * It is never arena-owned, so no verb writes into it: anything that
+ * would, allocates a fresh result instead, which is the copy in
+ * copy-on-write. Temporaries are dropped without k_free on some paths
+ * (longjmp, statement and eval arena resets), so references taken by
+ * the evaluator cannot be trusted to balance. Each buffer lent out is
+ * pinned with one extra reference and the number of owners outside
+ * the evaluator (var slots, k_get holders) is tracked beside it; when
+ * the eval ends its count is put back to exactly that. */
+
+typedef struct { K x; int owners; } ks_loan;
+
+struct ks_loans {
+    int n, cap;
+    ks_loan *e;
+};
+
+static ks_loan *loan_find(ks_ctx *ctx, K x) {
+    struct ks_loans *l = ctx->loans;
+    if (!l) return NULL;
+    for (int i = 0; i < l->n; i++) if (l->e[i].x == x) return &l->e[i];
+    return NULL;
+}
+
+static K var_loan(ks_ctx *ctx, K v) {
+    if (!loan_find(ctx, v)) {
+        struct ks_loans *l = ctx->loans;
+        if (!l && !(l = ctx->loans = calloc(1, sizeof(struct ks_loans)))) {
+            ctx->last_status = KS_ERR_OOM;
+            longjmp(ctx->recover, 1);
+        }
+        if (l->n == l->cap) {
+            int cap = l->cap ? l->cap * 2 : 32;
+            ks_loan *e = realloc(l->e, cap * sizeof(ks_loan));
+            if (!e) { ctx->last_status = KS_ERR_OOM; longjmp(ctx->recover, 1); }
+            l->e = e; l->cap = cap;
+        }
+        l->e[l->n].x = v;
+        l->e[l->n].owners = v->r;
+        l->n++;
+        v->r++;                  /* pin until loans_settle */
     }
-    K x = k_new(ctx, v->n);
-    memcpy(x->f, v->f, v->n * sizeof(double));
-    return x;
+    v->r++;
+    return v;
+}
+
+/* A var slot lets go of its buffer. */
+static void var_release(ks_ctx *ctx, K v) {
+    ks_loan *l = loan_find(ctx, v);
+    if (!l) { k_free(ctx, v); return; }
+    l->owners--;
+    v->r--;
+}
+
+/* Called once the eval's arena is gone: no evaluator reference is left. */
+static void loans_settle(ks_ctx *ctx) {
+    struct ks_loans *l = ctx->loans;
+    if (!l) return;
+    for (int i = 0; i < l->n; i++) {
+        K x = l->e[i].x;
+        x->r = l->e[i].owners;
+        if (x->r <= 0) perm_release(ctx, x);
+    }
+    l->n = 0;
+}
+
+static void loans_free(ks_ctx *ctx) {
+    if (!ctx->loans) return;
+    free(ctx->loans->e);
+    free(ctx->loans);
+    ctx->loans = NULL;
 }
 
 /* --- Function Support --- */
 
 K k_func(ks_ctx *ctx, char *body) {
     int len = strlen(body) + 1;
-    int ndoubles = (len + sizeof(double) - 1) / sizeof(double);
-    K x = k_new(ctx, ndoubles);
+    int nslots = (len + sizeof(ks_real) - 1) / sizeof(ks_real);
+    K x = k_new(ctx, nslots);
     x->n = -1;
     memcpy(x->f, body, len);
     return x;
@@ -215,8 +633,11 @@ char* k_func_body(K x) {
     return k_is_func(x) ? (char*)x->f : NULL;
 }
 
-/* Forward declarations for evaluation */
-K e(ks_ctx *ctx, char **s);
+/* Forward declarations: the compiled-body cache lives with the compiler */
+typedef struct ks_fn ks_fn;
+static ks_fn *fn_lookup(ks_ctx *ctx, const char *body);
+static int fn_arity(const ks_fn *f);
+static K fn_run(ks_ctx *ctx, ks_fn *f);
 
 K k_call(ks_ctx *ctx, K fn, K *call_args, int nargs) {
     if (!k_is_func(fn)) return NULL;
@@ -226,28 +647,21 @@ K k_call(ks_ctx *ctx, K fn, K *call_args, int nargs) {
 
     GAS_CHECK(ctx, 10); /* Function call overhead */
 
-    int uses_x = (strchr(body, 'x') != NULL);
-    int uses_y = (strchr(body, 'y') != NULL);
-
-    int required = 0;
-    if (uses_y) required = 2;
-    else if (uses_x) required = 1;
+    /* Body compiled and arity worked out once per distinct text. */
+    ks_fn *f = fn_lookup(ctx, body);
 
-    if (nargs < required) {
+    if (nargs < fn_arity(f)) {
         return k_new(ctx, 0);
     }
 
     K old_x = ctx->args[0];
     K old_y = ctx->args[1];
 
-    ctx->args[0] = k_new(ctx, 0);
-    ctx->args[1] = k_new(ctx, 0);
+    /* Arguments are borrowed: the caller still owns (and frees) them. */
+    ctx->args[0] = (nargs > 0 && call_args[0]) ? call_args[0] : NULL;
+    ctx->args[1] = (nargs > 1 && call_args[1]) ? call_args[1] : NULL;
 
-    if (nargs > 0 && call_args[0]) ctx->args[0] = call_args[0];
-    if (nargs > 1 && call_args[1]) ctx->args[1] = call_args[1];
-
-    char *s = body;
-    K result = e(ctx, &s);
+    K result = fn_run(ctx, f);
 
     ctx->args[0] = old_x;
     ctx->args[1] = old_y;
@@ -255,23 +669,386 @@ K k_call(ks_ctx *ctx, K fn, K *call_args, int nargs) {
     return result;
 }
 
-/* --- Scan Adverb --- */
+/* --- Worker Threads ---
+ * par_run(ctx, tasks, fn, arg) calls fn(arg, t) for every t in
+ * [0, tasks) and returns once all are done. The calling thread runs
+ * task 0 and then takes whatever tasks no worker has picked up yet.
+ * The workers belong to the context: they start the first time a
+ * kernel splits and wait on a condition variable between calls until
+ * ks_destroy, so a split costs a wake-up, not a thread start. Tasks
+ * never allocate from the arena or charge gas. Gas is charged on the
+ * calling thread before the work is split, so only that thread can
+ * longjmp, and never while a task is running. Kernels split their work
+ * by size, not by thread count, so results are the same however many
+ * threads run them. par_chunks splits a range of elements into one
+ * piece per task, on KS_PAR_ALIGN boundaries so no two threads write
+ * the same cache line. */
+
+#define KS_PAR_ALIGN 256
+
+#if KS_THREADS && defined(_WIN32)
+typedef HANDLE ks_thread;
+typedef SRWLOCK ks_mutex;
+typedef CONDITION_VARIABLE ks_cond;
+#define MUTEX_INIT(m)    (InitializeSRWLock(m), 1)
+#define MUTEX_FREE(m)    ((void)0)
+#define MUTEX_LOCK(m)    AcquireSRWLockExclusive(m)
+#define MUTEX_UNLOCK(m)  ReleaseSRWLockExclusive(m)
+#define COND_INIT(c)     (InitializeConditionVariable(c), 1)
+#define COND_FREE(c)     ((void)0)
+#define COND_WAIT(c, m)  SleepConditionVariableSRW(c, m, INFINITE, 0)
+#define COND_SIGNAL(c)   WakeConditionVariable(c)
+#define COND_BROADCAST(c) WakeAllConditionVariable(c)
+#elif KS_THREADS
+typedef pthread_t ks_thread;
+typedef pthread_mutex_t ks_mutex;
+typedef pthread_cond_t ks_cond;
+#define MUTEX_INIT(m)    (pthread_mutex_init(m, NULL) == 0)
+#define MUTEX_FREE(m)    pthread_mutex_destroy(m)
+#define MUTEX_LOCK(m)    pthread_mutex_lock(m)
+#define MUTEX_UNLOCK(m)  pthread_mutex_unlock(m)
+#define COND_INIT(c)     (pthread_cond_init(c, NULL) == 0)
+#define COND_FREE(c)     pthread_cond_destroy(c)
+#define COND_WAIT(c, m)  pthread_cond_wait(c, m)
+#define COND_SIGNAL(c)   pthread_cond_signal(c)
+#define COND_BROADCAST(c) pthread_cond_broadcast(c)
+#endif
+
+#if KS_THREADS
+struct ks_workers {
+    ks_mutex lock;
+    ks_cond go;              /* tasks waiting, or stop */
+    ks_cond done;            /* the last task of a call finished */
+    int n;                   /* threads running */
+    int stop;
+    void (*fn)(void *, int);
+    void *arg;
+    int tasks, next, left;   /* the current call: next task to take, tasks not finished */
+    ks_thread th[KS_MAX_THREADS];
+};
+
+/* Take and run tasks of the current call until there are none left;
+   called and returns with the lock held. */
+static void workers_drain(struct ks_workers *w) {
+    while (w->next < w->tasks) {
+        int t = w->next++;
+        MUTEX_UNLOCK(&w->lock);
+        w->fn(w->arg, t);
+        MUTEX_LOCK(&w->lock);
+        if (--w->left == 0) COND_SIGNAL(&w->done);
+    }
+}
+
+static void workers_loop(struct ks_workers *w) {
+    MUTEX_LOCK(&w->lock);
+    while (!w->stop) {
+        workers_drain(w);
+        if (!w->stop) COND_WAIT(&w->go, &w->lock);
+    }
+    MUTEX_UNLOCK(&w->lock);
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI workers_entry(LPVOID p) { workers_loop(p); return 0; }
+#else
+static void *workers_entry(void *p) { workers_loop(p); return NULL; }
+#endif
+
+/* Workers for up to `tasks` tasks, starting what is missing; NULL if
+   none could be set up, and the caller then runs every task itself. */
+static struct ks_workers *workers_ready(ks_ctx *ctx, int tasks) {
+    struct ks_workers *w = ctx->workers;
+    if (!w) {
+        if (!(w = calloc(1, sizeof *w))) return NULL;
+        if (!MUTEX_INIT(&w->lock)) { free(w); return NULL; }
+        if (!COND_INIT(&w->go)) { MUTEX_FREE(&w->lock); free(w); return NULL; }
+        if (!COND_INIT(&w->done)) { COND_FREE(&w->go); MUTEX_FREE(&w->lock); free(w); return NULL; }
+        ctx->workers = w;
+    }
+    while (w->n < tasks - 1) {
+#if defined(_WIN32)
+        if (!(w->th[w->n] = CreateThread(NULL, 0, workers_entry, w, 0, NULL))) break;
+#else
+        if (pthread_create(&w->th[w->n], NULL, workers_entry, w) != 0) break;
+#endif
+        w->n++;
+    }
+    return w;
+}
+
+static void workers_free(ks_ctx *ctx) {
+    struct ks_workers *w = ctx->workers;
+    if (!w) return;
+    MUTEX_LOCK(&w->lock);
+    w->stop = 1;
+    COND_BROADCAST(&w->go);
+    MUTEX_UNLOCK(&w->lock);
+    for (int t = 0; t < w->n; t++) {
+#if defined(_WIN32)
+        WaitForSingleObject(w->th[t], INFINITE);
+        CloseHandle(w->th[t]);
+#else
+        pthread_join(w->th[t], NULL);
+#endif
+    }
+    COND_FREE(&w->done);
+    COND_FREE(&w->go);
+    MUTEX_FREE(&w->lock);
+    free(w);
+    ctx->workers = NULL;
+}
+#else
+static void workers_free(ks_ctx *ctx) { (void)ctx; }
+#endif
+
+/* Tasks worth running for n elements: one per thread, at most one per
+   ctx->par_min elements. */
+static int par_tasks(ks_ctx *ctx, long long n) {
+    long long t = n / ctx->par_min;
+    if (t > ctx->threads) t = ctx->threads;
+    return t > 1 ? (int)t : 1;
+}
+
+static void par_run(ks_ctx *ctx, int tasks, void (*fn)(void *, int), void *arg) {
+#if KS_THREADS
+    struct ks_workers *w = tasks > 1 ? workers_ready(ctx, tasks) : NULL;
+    if (w) {
+        MUTEX_LOCK(&w->lock);
+        w->fn = fn; w->arg = arg;
+        w->tasks = tasks; w->next = 1; w->left = tasks;
+        COND_BROADCAST(&w->go);
+        MUTEX_UNLOCK(&w->lock);
+        fn(arg, 0);
+        MUTEX_LOCK(&w->lock);
+        w->left--;
+        workers_drain(w);
+        while (w->left > 0) COND_WAIT(&w->done, &w->lock);
+        MUTEX_UNLOCK(&w->lock);
+        return;
+    }
+#endif
+    (void)ctx;
+    for (int t = 0; t < tasks; t++) fn(arg, t);
+}
+
+typedef struct {
+    void (*fn)(void *, int, int, int);
+    void *arg;
+    int n, tasks;
+} ks_chunks;
+
+static int chunk_at(const ks_chunks *c, int t) {
+    if (t == c->tasks) return c->n;
+    return (int)((long long)c->n * t / c->tasks) & ~(KS_PAR_ALIGN - 1);
+}
+
+static void chunks_task(void *arg, int t) {
+    ks_chunks *c = arg;
+    c->fn(c->arg, t, chunk_at(c, t), chunk_at(c, t + 1));
+}
+
+/* fn(arg, t, i0, i1) over pieces [i0, i1) of [0, n), side by side
+   when n is long; t is the piece's task. */
+static void par_chunks(ks_ctx *ctx, int n, void (*fn)(void *, int, int, int), void *arg) {
+    ks_chunks c = { fn, arg, n, par_tasks(ctx, n) };
+    if (c.tasks == 1) fn(arg, 0, 0, n);
+    else par_run(ctx, c.tasks, chunks_task, &c);
+}
+
+void ks_set_threads(ks_ctx *ctx, int n) {
+    if (!ctx) return;
+    ctx->threads = n < 1 ? 1 : (n > KS_MAX_THREADS ? KS_MAX_THREADS : n);
+}
+
+void ks_set_par_min(ks_ctx *ctx, int n) {
+    if (!ctx) return;
+    ctx->par_min = n < KS_PAR_ALIGN ? KS_PAR_ALIGN : n;
+}
+
+/* --- Scan Adverb ---
+ * `+\`, `*\`, `&\` and `|\` run in segments of KS_SCAN_SEG elements.
+ * A first pass reduces each segment to its total, a short serial pass
+ * turns the totals into the value carried into each segment, and a
+ * second pass scans every segment from its carry. Both passes split
+ * segments across threads, and the second scans KS_SCAN_LANES segments
+ * side by side so their dependency chains overlap. Segment sizes are
+ * fixed, so the result is the same for any thread count.
+ *
+ * Sums are compensated: each run of KS_SCAN_RUN elements is summed
+ * plainly from zero and added to the output of a carry kept as a
+ * double-double (TwoSum), so the error of a long phase accumulation
+ * stays at the level of one run instead of growing with its length.
+ * Min and max give exactly the serial result; products round in a
+ * different order. Needs IEEE arithmetic: no -ffast-math. */
+
+#define KS_SCAN_RUN   64
+#define KS_SCAN_SEG   (63 * KS_SCAN_RUN)   /* not a multiple of 4 KB apart */
+#define KS_SCAN_LANES 4
+
+/* (s, c) += v, with the rounding error of s + v added into c. */
+#define TWO_SUM(s, c, v) do {                                                 \
+    double t_ = (s) + (v), z_ = t_ - (s);                                     \
+    (c) += ((s) - (t_ - z_)) + ((v) - z_);                                    \
+    (s) = t_;                                                                 \
+} while (0)
+
+typedef struct {
+    char op;
+    int n, segs, tasks;
+    const ks_real *a;
+    ks_real *o;
+    double *hi, *lo;     /* segment totals, then carries into each segment */
+} ks_scan_job;
+
+static int scan_len(const ks_scan_job *j, int g) {
+    return j->n - g * KS_SCAN_SEG < KS_SCAN_SEG ? j->n - g * KS_SCAN_SEG : KS_SCAN_SEG;
+}
+
+/* Total of segment g. Segment 0 of a min or max folds from its first
+   element like the serial scan, the rest from the identity. */
+static void scan_total(ks_scan_job *j, int g) {
+    const ks_real *a = j->a + (size_t)g * KS_SCAN_SEG;
+    int len = scan_len(j, g);
+    double acc = 0.0, c = 0.0, p[4];
+    switch (j->op) {
+    case '+':
+        for (int r = 0; r < len; r += KS_SCAN_RUN) {
+            int e = len - r < KS_SCAN_RUN ? len : r + KS_SCAN_RUN, i = r;
+            p[0] = p[1] = p[2] = p[3] = 0.0;
+            for (; i + 4 <= e; i += 4)
+                for (int w = 0; w < 4; w++) p[w] += a[i + w];
+            for (; i < e; i++) p[0] += a[i];
+            double s = (p[0] + p[1]) + (p[2] + p[3]);
+            TWO_SUM(acc, c, s);
+        }
+        break;
+    case '*': {
+        int i = 0;
+        p[0] = p[1] = p[2] = p[3] = 1.0;
+        for (; i + 4 <= len; i += 4)
+            for (int w = 0; w < 4; w++) p[w] *= a[i + w];
+        for (; i < len; i++) p[0] *= a[i];
+        acc = (p[0] * p[1]) * (p[2] * p[3]);
+        break;
+    }
+    case '&':
+        acc = g ? INFINITY : a[0];
+        for (int i = 0; i < len; i++) acc = a[i] < acc ? a[i] : acc;
+        break;
+    case '|':
+        acc = g ? -INFINITY : a[0];
+        for (int i = 0; i < len; i++) acc = a[i] > acc ? a[i] : acc;
+        break;
+    }
+    j->hi[g] = acc; j->lo[g] = c;
+}
+
+static void scan_totals_task(void *arg, int t) {
+    ks_scan_job *j = arg;
+    int g1 = (int)((long long)(j->segs - 1) * (t + 1) / j->tasks);
+    for (int g = (int)((long long)(j->segs - 1) * t / j->tasks); g < g1; g++) scan_total(j, g);
+}
+
+/* Scan LANES segments from g on, side by side, from their carries.
+   With a constant lane count every running value stays in a register.
+   An inf or NaN in the input makes the carry's low part NaN, and the
+   sum then follows the high part alone, like the serial scan. */
+#define SCAN_SEGS(LANES, LEN) do {                                            \
+    const ks_real *a[LANES];                                                  \
+    ks_real *o[LANES];                                                        \
+    double s[LANES], c[LANES];                                                \
+    for (int w = 0; w < LANES; w++) {                                         \
+        a[w] = j->a + (size_t)(g + w) * KS_SCAN_SEG;                          \
+        o[w] = j->o + (size_t)(g + w) * KS_SCAN_SEG;                          \
+        s[w] = j->hi[g + w]; c[w] = j->lo[g + w];                             \
+    }                                                                         \
+    if (g == 0 && (j->op == '&' || j->op == '|')) s[0] = a[0][0];             \
+    switch (j->op) {                                                          \
+    case '+':                                                                 \
+        for (int r = 0; r < (LEN); r += KS_SCAN_RUN) {                        \
+            int e = (LEN) - r < KS_SCAN_RUN ? (LEN) : r + KS_SCAN_RUN;        \
+            double l[LANES], lo[LANES];                                       \
+            for (int w = 0; w < LANES; w++) { l[w] = 0.0; lo[w] = c[w] == c[w] ? c[w] : 0.0; } \
+            for (int i = r; i < e; i++)                                       \
+                for (int w = 0; w < LANES; w++) {                             \
+                    l[w] += a[w][i]; o[w][i] = s[w] + (l[w] + lo[w]);         \
+                }                                                             \
+            for (int w = 0; w < LANES; w++) TWO_SUM(s[w], c[w], l[w]);        \
+        }                                                                     \
+        break;                                                                \
+    case '*': SCAN_STEP(LANES, LEN, s[w] *= a[w][i]); break;                  \
+    case '&': SCAN_STEP(LANES, LEN, s[w] = a[w][i] < s[w] ? a[w][i] : s[w]); break; \
+    case '|': SCAN_STEP(LANES, LEN, s[w] = a[w][i] > s[w] ? a[w][i] : s[w]); break; \
+    }                                                                         \
+} while (0)
+
+#define SCAN_STEP(LANES, LEN, STEP)                                           \
+    for (int i = 0; i < (LEN); i++)                                           \
+        for (int w = 0; w < LANES; w++) { STEP; o[w][i] = s[w]; }
+
+static void scan_group(ks_scan_job *j, int g) {
+    SCAN_SEGS(KS_SCAN_LANES, KS_SCAN_SEG);
+}
+
+static void scan_seg(ks_scan_job *j, int g) {
+    int len = scan_len(j, g);
+    SCAN_SEGS(1, len);
+}
+
+static void scan_lanes_task(void *arg, int t) {
+    ks_scan_job *j = arg;
+    int groups = j->segs / KS_SCAN_LANES;
+    if (groups * KS_SCAN_LANES == j->segs && scan_len(j, j->segs - 1) < KS_SCAN_SEG)
+        groups--;   /* the short last segment goes on its own */
+    int q1 = (int)((long long)groups * (t + 1) / j->tasks);
+    for (int q = (int)((long long)groups * t / j->tasks); q < q1; q++)
+        scan_group(j, q * KS_SCAN_LANES);
+    if (t == j->tasks - 1)
+        for (int g = groups * KS_SCAN_LANES; g < j->segs; g++) scan_seg(j, g);
+}
+
+static void scan_blocked(ks_ctx *ctx, char op, ks_real *o, const ks_real *a, int n) {
+    ks_scan_job j = { op, n, (n + KS_SCAN_SEG - 1) / KS_SCAN_SEG, 1, a, o, NULL, NULL };
+    j.tasks = par_tasks(ctx, n);
+    if (j.tasks == 1 && (op == '&' || op == '|')) {
+        /* exact whichever way it is split; one pass is enough */
+        double s = a[0];
+        for (int i = 0; i < n; i++) { double v = a[i]; s = op == '&' ? (v < s ? v : s) : (v > s ? v : s); o[i] = s; }
+        return;
+    }
+    char *mark = ctx->arena_ptr;
+    j.hi = arena_alloc(ctx, j.segs * sizeof(double));
+    j.lo = arena_alloc(ctx, j.segs * sizeof(double));
+    par_run(ctx, j.tasks, scan_totals_task, &j);   /* all but the last */
+    double s = op == '*' ? 1.0 : 0.0, c = 0.0;
+    for (int g = 0; g < j.segs; g++) {
+        double hi = j.hi[g], lo = j.lo[g];
+        j.hi[g] = s; j.lo[g] = c;
+        if (g == j.segs - 1) break;
+        switch (op) {
+        case '+': TWO_SUM(s, c, hi); c += lo; break;
+        case '*': s *= hi; break;
+        case '&': s = (g == 0 || hi < s) ? hi : s; break;
+        case '|': s = (g == 0 || hi > s) ? hi : s; break;
+        }
+    }
+    par_run(ctx, j.tasks, scan_lanes_task, &j);
+    ctx->arena_ptr = mark;
+}
 
 K scan(ks_ctx *ctx, char op, K b) {
     if (!b || b->n < 1) return b;
-    K x = k_new(ctx, b->n);
+    K x = k_reuse(ctx, b);
     double acc;
 
     GAS_CHECK(ctx, b->n);
 
     switch(op) {
         case '+':
-            acc = 0.0;
-            for (int i = 0; i < b->n; i++) { acc += b->f[i]; x->f[i] = acc; }
-            break;
         case '*':
-            acc = 1.0;
-            for (int i = 0; i < b->n; i++) { acc *= b->f[i]; x->f[i] = acc; }
+        case '&':
+        case '|':
+            scan_blocked(ctx, op, x->f, b->f, b->n);
             break;
         case '-':
             acc = 0.0;
@@ -284,32 +1061,16 @@ K scan(ks_ctx *ctx, char op, K b) {
                 x->f[i] = acc;
             }
             break;
-        case '&':
-            acc = b->f[0];
-            x->f[0] = acc;
-            for (int i = 1; i < b->n; i++) {
-                if (b->f[i] < acc) acc = b->f[i];
-                x->f[i] = acc;
-            }
-            break;
-        case '|':
-            acc = b->f[0];
-            x->f[0] = acc;
-            for (int i = 1; i < b->n; i++) {
-                if (b->f[i] > acc) acc = b->f[i];
-                x->f[i] = acc;
-            }
-            break;
         case '^':
             acc = b->f[0];
             x->f[0] = acc;
             for (int i = 1; i < b->n; i++) {
-                acc = safe_val(pow(acc, b->f[i]));
+                acc = safe_step(pow(acc, b->f[i]));
                 x->f[i] = acc;
             }
             break;
         default:
-            memcpy(x->f, b->f, b->n * sizeof(double));
+            memcpy(x->f, b->f, b->n * sizeof(ks_real));
             break;
     }
 
@@ -328,128 +1089,1167 @@ K scan(ks_ctx *ctx, char op, K b) {
  * by the GAS_CHECK macro to prevent audio thread lockups.
  */
 
-K mo(ks_ctx *ctx, char c, K b) {
-    if (!b) return NULL;
+/* Per-element kernels shared by mo/dy and the fused evaluator, so a
+   fused chain produces exactly the values the verb-at-a-time path does. */
+static inline double mo1(char c, double v) {
+    switch (c) {
+        case 's': return sin(v);
+        case 'c': return cos(v);
+        case 't': return tan(v);
+        case 'h': return tanh(v);
+        case 'a': return fabs(v);
+        case 'q': return sqrt(fabs(v));
+        case 'l': return log(fabs(v) + 1e-10);
+        case 'e': return exp((v > KS_EXP_MAX) ? KS_EXP_MAX : ((v < -KS_EXP_MAX) ? -KS_EXP_MAX : v));
+        case '_': return floor(v);
+        case 'p': return (v == 0) ? 44100 : M_PI * v;
+        case 'x': return exp(-5.0 * v);
+        case 'd': return tanh(v * 3.0);
+        case 'n': return 440.0 * pow(2.0, (v - 69.0) / 12.0);
+        default:  return v;
+    }
+}
 
-    if (c >= 'A' && c <= 'Z') {
-        K var = ctx->vars[c - 'A'];
-        if (k_is_func(var)) {
-            K call_args[1] = {b};
-            return k_call(ctx, var, call_args, 1);
-        }
+static inline double dy1(char c, double va, double vb) {
+    switch (c) {
+        case '+': return va + vb;
+        case '*': return va * vb;
+        case '-': return va - vb;
+        case '%': return (vb == 0) ? 0 : va / vb;
+        case '^': return safe_val(pow(fabs(va), vb));
+        case '&': return va < vb ? va : vb;
+        case '|': return va > vb ? va : vb;
+        case '<': return va < vb ? 1.0 : 0.0;
+        case '>': return va > vb ? 1.0 : 0.0;
+        case '=': return va == vb ? 1.0 : 0.0;
+        default:  return 0;
     }
+}
 
-    K x;
+/* --- Dyadic Kernels ---
+ * o[i] = a[i*ia] op b[i*ib], where ia/ib is 0 for a scalar broadcast
+ * and 1 for a full-length operand. The operator is picked once per
+ * call and each case runs a loop over SIMD registers, then finishes
+ * the tail with the scalar form of the same op. Every vector op gives
+ * bit-for-bit what dy1 gives, so results don't depend on the ISA. */
+
+#if defined(__AVX__) && defined(KS_FLOAT32)
+typedef __m256 ks_vec;
+#define KS_VW       8
+#define V_LD(p)     _mm256_loadu_ps(p)
+#define V_ST(p, v)  _mm256_storeu_ps(p, v)
+#define V_SET(s)    _mm256_set1_ps(s)
+#define V_ADD       _mm256_add_ps
+#define V_SUB       _mm256_sub_ps
+#define V_MUL       _mm256_mul_ps
+#define V_MIN       _mm256_min_ps
+#define V_MAX       _mm256_max_ps
+#define V_LT(x, y)  _mm256_and_ps(_mm256_cmp_ps(x, y, _CMP_LT_OQ), _mm256_set1_ps(1.0f))
+#define V_GT(x, y)  _mm256_and_ps(_mm256_cmp_ps(x, y, _CMP_GT_OQ), _mm256_set1_ps(1.0f))
+#define V_EQ(x, y)  _mm256_and_ps(_mm256_cmp_ps(x, y, _CMP_EQ_OQ), _mm256_set1_ps(1.0f))
+#define V_DIV(x, y) _mm256_andnot_ps(_mm256_cmp_ps(y, _mm256_setzero_ps(), _CMP_EQ_OQ), _mm256_div_ps(x, y))
+#elif defined(__AVX__)
+typedef __m256d ks_vec;
+#define KS_VW       4
+#define V_LD(p)     _mm256_loadu_pd(p)
+#define V_ST(p, v)  _mm256_storeu_pd(p, v)
+#define V_SET(s)    _mm256_set1_pd(s)
+#define V_ADD       _mm256_add_pd
+#define V_SUB       _mm256_sub_pd
+#define V_MUL       _mm256_mul_pd
+#define V_MIN       _mm256_min_pd
+#define V_MAX       _mm256_max_pd
+#define V_LT(x, y)  _mm256_and_pd(_mm256_cmp_pd(x, y, _CMP_LT_OQ), _mm256_set1_pd(1.0))
+#define V_GT(x, y)  _mm256_and_pd(_mm256_cmp_pd(x, y, _CMP_GT_OQ), _mm256_set1_pd(1.0))
+#define V_EQ(x, y)  _mm256_and_pd(_mm256_cmp_pd(x, y, _CMP_EQ_OQ), _mm256_set1_pd(1.0))
+#define V_DIV(x, y) _mm256_andnot_pd(_mm256_cmp_pd(y, _mm256_setzero_pd(), _CMP_EQ_OQ), _mm256_div_pd(x, y))
+#elif defined(__SSE2__) && defined(KS_FLOAT32)
+typedef __m128 ks_vec;
+#define KS_VW       4
+#define V_LD(p)     _mm_loadu_ps(p)
+#define V_ST(p, v)  _mm_storeu_ps(p, v)
+#define V_SET(s)    _mm_set1_ps(s)
+#define V_ADD       _mm_add_ps
+#define V_SUB       _mm_sub_ps
+#define V_MUL       _mm_mul_ps
+#define V_MIN       _mm_min_ps
+#define V_MAX       _mm_max_ps
+#define V_LT(x, y)  _mm_and_ps(_mm_cmplt_ps(x, y), _mm_set1_ps(1.0f))
+#define V_GT(x, y)  _mm_and_ps(_mm_cmpgt_ps(x, y), _mm_set1_ps(1.0f))
+#define V_EQ(x, y)  _mm_and_ps(_mm_cmpeq_ps(x, y), _mm_set1_ps(1.0f))
+#define V_DIV(x, y) _mm_andnot_ps(_mm_cmpeq_ps(y, _mm_setzero_ps()), _mm_div_ps(x, y))
+#elif defined(__SSE2__)
+typedef __m128d ks_vec;
+#define KS_VW       2
+#define V_LD(p)     _mm_loadu_pd(p)
+#define V_ST(p, v)  _mm_storeu_pd(p, v)
+#define V_SET(s)    _mm_set1_pd(s)
+#define V_ADD       _mm_add_pd
+#define V_SUB       _mm_sub_pd
+#define V_MUL       _mm_mul_pd
+#define V_MIN       _mm_min_pd
+#define V_MAX       _mm_max_pd
+#define V_LT(x, y)  _mm_and_pd(_mm_cmplt_pd(x, y), _mm_set1_pd(1.0))
+#define V_GT(x, y)  _mm_and_pd(_mm_cmpgt_pd(x, y), _mm_set1_pd(1.0))
+#define V_EQ(x, y)  _mm_and_pd(_mm_cmpeq_pd(x, y), _mm_set1_pd(1.0))
+#define V_DIV(x, y) _mm_andnot_pd(_mm_cmpeq_pd(y, _mm_setzero_pd()), _mm_div_pd(x, y))
+#endif
 
-    if (c == '!') {
-        int n = (int)b->f[0]; k_free(ctx, b);
-        if (n < 0 || n > 1000000) { ctx->last_status = KS_ERR_INVALID_ARGS; longjmp(ctx->recover, 1); }
-        GAS_CHECK(ctx, n);
-        x = k_new(ctx, n);
-        for (int j = 0; j < n; j++) x->f[j] = (double)j;
-        return x;
-    }
+/* Scalar forms, matching dy1 (min/max pick y on ties and NaN, like
+   the SSE/AVX instructions). */
+#define S_ADD(x, y) ((x) + (y))
+#define S_SUB(x, y) ((x) - (y))
+#define S_MUL(x, y) ((x) * (y))
+#define S_MIN(x, y) ((x) < (y) ? (x) : (y))
+#define S_MAX(x, y) ((x) > (y) ? (x) : (y))
+#define S_LT(x, y)  ((x) < (y) ? 1 : 0)
+#define S_GT(x, y)  ((x) > (y) ? 1 : 0)
+#define S_EQ(x, y)  ((x) == (y) ? 1 : 0)
+#define S_DIV(x, y) ((y) == 0 ? 0 : (x) / (y))
+
+#ifdef KS_VW
+#define DY_VEC(V) do {                                                        \
+    if (ia && ib)                                                             \
+        for (; i + KS_VW <= n; i += KS_VW) V_ST(o + i, V(V_LD(a + i), V_LD(b + i))); \
+    else if (ia) {                                                            \
+        ks_vec vb = V_SET(b[0]);                                              \
+        for (; i + KS_VW <= n; i += KS_VW) V_ST(o + i, V(V_LD(a + i), vb));   \
+    } else if (ib) {                                                          \
+        ks_vec va = V_SET(a[0]);                                              \
+        for (; i + KS_VW <= n; i += KS_VW) V_ST(o + i, V(va, V_LD(b + i)));   \
+    }                                                                         \
+} while (0)
+#else
+#define DY_VEC(V) do { } while (0)
+#endif
 
-    if (c == '~') {
-        int n = (int)b->f[0]; k_free(ctx, b);
-        if (n < 1 || n > 1000000) return k_new(ctx, 0);
-        GAS_CHECK(ctx, n);
-        x = k_new(ctx, n);
-        double twopi = 2.0 * M_PI;
-        for (int j = 0; j < n; j++) x->f[j] = twopi * (double)j / (double)n;
-        return x;
+#define DY_LOOP(V, S) do {                                                    \
+    int i = 0;                                                                \
+    DY_VEC(V);                                                                \
+    if (ia && ib)  for (; i < n; i++) o[i] = S(a[i], b[i]);                   \
+    else if (ia) { ks_real y = b[0]; for (; i < n; i++) o[i] = S(a[i], y); }  \
+    else if (ib) { ks_real x = a[0]; for (; i < n; i++) o[i] = S(x, b[i]); }  \
+    else { ks_real v = S(a[0], b[0]); for (; i < n; i++) o[i] = v; }          \
+} while (0)
+
+static void dy_kernel(char c, ks_real *o, const ks_real *a, int ia,
+                      const ks_real *b, int ib, int n) {
+    switch (c) {
+    case '+': DY_LOOP(V_ADD, S_ADD); break;
+    case '-': DY_LOOP(V_SUB, S_SUB); break;
+    case '*': DY_LOOP(V_MUL, S_MUL); break;
+    case '%': DY_LOOP(V_DIV, S_DIV); break;
+    case '&': DY_LOOP(V_MIN, S_MIN); break;
+    case '|': DY_LOOP(V_MAX, S_MAX); break;
+    case '<': DY_LOOP(V_LT, S_LT); break;
+    case '>': DY_LOOP(V_GT, S_GT); break;
+    case '=': DY_LOOP(V_EQ, S_EQ); break;
+    default:
+        for (int i = 0; i < n; i++) o[i] = dy1(c, a[i * ia], b[i * ib]);
+        break;
     }
+}
 
-    if (c == '+') {
-        double t = 0;
-        GAS_CHECK(ctx, b->n);
-        for (int i = 0; i < b->n; i++) t += b->f[i];
-        x = k_new(ctx, 1); x->f[0] = t;
-        k_free(ctx, b); return x;
-    }
+typedef struct {
+    char c;
+    ks_real *o;
+    const ks_real *a, *b;
+    int ia, ib;
+} ks_dy_job;
+
+static void dy_chunk(void *arg, int t, int i0, int i1) {
+    (void)t;
+    ks_dy_job *j = arg;
+    dy_kernel(j->c, j->o + i0, j->a + i0 * j->ia, j->ia, j->b + i0 * j->ib, j->ib, i1 - i0);
+}
 
-    if (c == '>') {
-        double m = 0;
-        GAS_CHECK(ctx, b->n);
-        for (int i = 0; i < b->n; i++) if (fabs(b->f[i]) > m) m = fabs(b->f[i]);
-        x = k_new(ctx, 1); x->f[0] = m;
-        k_free(ctx, b); return x;
-    }
+/* dy_kernel over n elements, split across threads when n is long. */
+static void dy_par(ks_ctx *ctx, char c, ks_real *o, const ks_real *a, int ia,
+                   const ks_real *b, int ib, int n) {
+    ks_dy_job j = { c, o, a, b, ia, ib };
+    par_chunks(ctx, n, dy_chunk, &j);
+}
 
-    if (c == 'w') {
-        double pk = 0.0;
-        GAS_CHECK(ctx, b->n);
-        for (int i = 0; i < b->n; i++) if (fabs(b->f[i]) > pk) pk = fabs(b->f[i]);
-        x = k_new(ctx, b->n);
-        double scale = (pk > 1e-10) ? 1.0 / pk : 0.0;
-        for (int i = 0; i < b->n; i++) x->f[i] = b->f[i] * scale;
-        k_free(ctx, b); return x;
-    }
+/* --- Monadic Kernels ---
+ * mo_kernel is mo1 over a whole vector, with the verb picked once per
+ * call. In KS_EXACT mode every element goes through libm. In KS_FAST
+ * mode the transcendental verbs use the approximations below instead:
+ * Cody-Waite range reduction and a short polynomial, with 2^k, the
+ * quadrant and the exponent handled as integer bit operations. There
+ * is no branch or select on a double anywhere in them, so the compiler
+ * vectorises the loops even under the default -ftrapping-math. They
+ * hold to within a few ulp of libm on their working range; elements
+ * outside it (huge phases, overflow, inf, NaN) are redone with libm,
+ * so the fast mode never changes where results saturate. */
+
+#define KS_MO_BLOCK 256
+#define KS_FAST_MO  "sctdhlexn"
+#define KS_FAST_SHIFT 0x1.8p52        /* adding it rounds to an integer */
+#define KS_FAST_EXP_MAX 708.0         /* 2^k stays a normal double */
+#define KS_FAST_TANH_MAX 20.0         /* tanh is 1 to double precision */
+#define KS_FAST_TRIG_MAX 1e5          /* three-part pi/2 is exact to here */
+#define KS_LN2_HI 6.93147180369123816490e-01
+#define KS_LN2_LO 1.90821492927058770002e-10
+
+static inline uint64_t fast_bits(double v) { uint64_t u; memcpy(&u, &v, 8); return u; }
+static inline double fast_real(uint64_t u) { double v; memcpy(&v, &u, 8); return v; }
+
+/* e^r = 1 + q for |r| <= ln2/2, and s = 2^k. Keeping the 1 out of q
+   lets expm1 cancel exactly. */
+static inline double fast_expq(uint64_t k, double r, double *s) {
+    double q = 1.0 / 479001600;
+    q = q * r + 1.0 / 39916800; q = q * r + 1.0 / 3628800;
+    q = q * r + 1.0 / 362880;   q = q * r + 1.0 / 40320;
+    q = q * r + 1.0 / 5040;     q = q * r + 1.0 / 720;
+    q = q * r + 1.0 / 120;      q = q * r + 1.0 / 24;
+    q = q * r + 1.0 / 6;        q = q * r + 0.5;
+    q = q * r * r + r;
+    *s = fast_real((k + 1023) << 52);
+    return q;
+}
 
-    if (c == 'j') {
-        if (b->n < 2) { k_free(ctx, b); return k_new(ctx, 0); }
-        int n = b->n / 2;
-        GAS_CHECK(ctx, n);
-        x = k_new(ctx, n);
-        for (int i = 0; i < x->n; i++) x->f[i] = b->f[i*2];
-        k_free(ctx, b); return x;
-    }
+/* v = k ln2 + r, so e^v = 2^k (1 + q). */
+static inline double fast_expm(double v, double *s) {
+    double t = v * 1.44269504088896338700 + KS_FAST_SHIFT;
+    double kd = t - KS_FAST_SHIFT;
+    double r = (v - kd * KS_LN2_HI) - kd * KS_LN2_LO;
+    return fast_expq(fast_bits(t) - fast_bits(KS_FAST_SHIFT), r, s);
+}
 
-    if (c == 'k') {
-        if (b->n < 2) { k_free(ctx, b); return k_new(ctx, 0); }
-        int n = b->n / 2;
-        GAS_CHECK(ctx, n);
-        x = k_new(ctx, n);
-        for (int i = 0; i < x->n; i++) x->f[i] = b->f[i*2+1];
-        k_free(ctx, b); return x;
-    }
+/* 2^v, split exactly at the integer part. */
+static inline double fast_exp2(double v) {
+    double t = v + KS_FAST_SHIFT;
+    double s, q = fast_expq(fast_bits(t) - fast_bits(KS_FAST_SHIFT),
+                            (v - (t - KS_FAST_SHIFT)) * M_LN2, &s);
+    return s + s * q;
+}
 
-    if (c == 'v') {
-        GAS_CHECK(ctx, b->n);
-        x = k_new(ctx, b->n);
-        for (int i = 0; i < b->n; i++)
-            x->f[i] = floor(b->f[i] * 4.0) / 4.0;
-        k_free(ctx, b); return x;
-    }
+static inline double fast_exp(double v) {
+    double s, q = fast_expm(v, &s);
+    return s + s * q;
+}
 
-    GAS_CHECK(ctx, b->n);
-    x = k_new(ctx, b->n);
-    for (int i = 0; i < b->n; i++) {
-        double v = b->f[i];
-        switch (c) {
-            case 's': x->f[i] = sin(v); break;
-            case 'c': x->f[i] = cos(v); break;
-            case 't': x->f[i] = tan(v); break;
-            case 'h': x->f[i] = tanh(v); break;
-            case 'a': x->f[i] = fabs(v); break;
-            case 'q': x->f[i] = sqrt(fabs(v)); break;
-            case 'l': x->f[i] = log(fabs(v) + 1e-10); break;
-            case 'e': {
-                double cl = (v > 100) ? 100 : ((v < -100) ? -100 : v);
-                x->f[i] = exp(cl);
-                break;
-            }
-            case '_': x->f[i] = floor(v); break;
-            case 'r': x->f[i] = ((double)rand() / (double)RAND_MAX) * 2.0 - 1.0; break;
-            case 'p': x->f[i] = (v == 0) ? 44100 : M_PI * v; break;
-            case 'i': x->f[i] = b->f[b->n - 1 - i]; break;
-            case 'x': x->f[i] = exp(-5.0 * v); break;
-            case 'd': x->f[i] = tanh(v * 3.0); break;
-            case 'm': {
-                unsigned int clock = i;
-                unsigned int hh = (clock * 13) ^ (clock >> 5) ^ (clock * 193);
-                x->f[i] = (hh & 128) ? 0.7 : -0.7;
-                break;
+/* tanh v = m / (m + 2) with m = e^2|v| - 1. */
+static inline double fast_tanh(double v) {
+    double s, q = fast_expm(2.0 * fabs(v), &s);
+    double m = (s - 1.0) + s * q;
+    return copysign(m / (m + 2.0), v);
+}
+
+/* ln of a positive normal: the mantissa is folded into
+   [sqrt(1/2), sqrt(2)) by moving the split point of the exponent, then
+   the atanh series in s = f/(2+f). */
+static inline double fast_log(double v) {
+    const uint64_t off = 0x3fe6955500000000ULL, top = 0xfff0000000000000ULL;
+    uint64_t u = fast_bits(v), t = u - off + (1024ULL << 52);
+    double e = fast_real(fast_bits(KS_FAST_SHIFT) + (t >> 52)) - KS_FAST_SHIFT - 1024.0;
+    double m = fast_real(u - (t & top) + (1024ULL << 52));
+    double f = m - 1.0, s = f / (2.0 + f), z = s * s;
+    double p = 2.0 / 19;
+    p = p * z + 2.0 / 17; p = p * z + 2.0 / 15; p = p * z + 2.0 / 13;
+    p = p * z + 2.0 / 11; p = p * z + 2.0 / 9;  p = p * z + 2.0 / 7;
+    p = p * z + 2.0 / 5;  p = p * z + 2.0 / 3;
+    return e * KS_LN2_HI + ((2.0 * s + s * z * p) + e * KS_LN2_LO);
+}
+
+/* sin and cos of the reduced argument r, |r| <= pi/4, and the
+   quadrant k mod 4. */
+static inline void fast_reduce(double v, double *sr, double *cr, uint64_t *q) {
+    double t = v * 6.36619772367581382433e-01 + KS_FAST_SHIFT;
+    *q = fast_bits(t) - fast_bits(KS_FAST_SHIFT);
+    double k = t - KS_FAST_SHIFT;
+    double r = v - k * 1.57079632673412561417e+00;
+    r = r - k * 6.07710050630396597660e-11;
+    r = r - k * 2.02226624871116645580e-21;
+    double z = r * r;
+    double s = 1.58969099521155010221e-10;
+    s = s * z - 2.50507602534068634195e-08; s = s * z + 2.75573137070700676789e-06;
+    s = s * z - 1.98412698298579493134e-04; s = s * z + 8.33333333332248946124e-03;
+    s = s * z - 1.66666666666666324348e-01;
+    double c = -1.13596475577881948265e-11;
+    c = c * z + 2.08757232129817482790e-09; c = c * z - 2.75573143513906633035e-07;
+    c = c * z + 2.48015872894767294178e-05; c = c * z - 1.38888888888741095749e-03;
+    c = c * z + 4.16666666666666019037e-02;
+    *sr = r + r * z * s;
+    *cr = 1.0 - 0.5 * z + z * z * c;
+}
+
+/* x if bit 0 of q is set, else y; then negated if bit 1 of neg is. */
+static inline double fast_quad(uint64_t q, double x, double y, uint64_t neg) {
+    uint64_t m = -(q & 1);
+    return fast_real(((fast_bits(x) & m) | (fast_bits(y) & ~m)) ^ ((neg & 2) << 62));
+}
+
+static inline double fast_sin(double v) {
+    double s, c; uint64_t q;
+    fast_reduce(v, &s, &c, &q);
+    return fast_quad(q, c, s, q);
+}
+
+static inline double fast_cos(double v) {
+    double s, c; uint64_t q;
+    fast_reduce(v, &s, &c, &q);
+    return fast_quad(q, s, c, q + 1);
+}
+
+static inline double fast_tan(double v) {
+    double s, c; uint64_t q;
+    fast_reduce(v, &s, &c, &q);
+    return fast_quad(q, c, s, q) / fast_quad(q, s, c, q + 1);
+}
+
+/* One block: the fast form F of verb c for every element, then the
+   exact form wherever the argument is outside the fast range (OK). */
+#define MO_FAST(F, OK) do {                                                   \
+    for (int i = 0; i < cnt; i++) { double v = a[i]; t[i] = F; }              \
+    for (int i = 0; i < cnt; i++) { double v = a[i]; if (!(OK)) t[i] = mo1(c, v); } \
+} while (0)
+
+static void mo_fast(char c, double *t, const ks_real *a, int cnt) {
+    switch (c) {
+    case 's': MO_FAST(fast_sin(v), fabs(v) <= KS_FAST_TRIG_MAX); break;
+    case 'c': MO_FAST(fast_cos(v), fabs(v) <= KS_FAST_TRIG_MAX); break;
+    case 't': MO_FAST(fast_tan(v), fabs(v) <= KS_FAST_TRIG_MAX); break;
+    case 'h': MO_FAST(fast_tanh(v), fabs(v) <= KS_FAST_TANH_MAX); break;
+    case 'd': MO_FAST(fast_tanh(v * 3.0), fabs(v * 3.0) <= KS_FAST_TANH_MAX); break;
+    case 'l': MO_FAST(fast_log(fabs(v) + 1e-10), fabs(v) <= 1e300); break;
+    case 'e': MO_FAST(fast_exp(v), fabs(v) <= KS_EXP_MAX); break;
+    case 'x': MO_FAST(fast_exp(-5.0 * v), fabs(5.0 * v) <= KS_FAST_EXP_MAX); break;
+    case 'n': MO_FAST(440.0 * fast_exp2((v - 69.0) / 12.0),
+                      fabs((v - 69.0) / 12.0) <= 1000.0); break;
+    }
+}
+
+/* o[i] = mo1(c, a[i*ia]); o may be a. */
+static void mo_kernel(char c, ks_accuracy acc, ks_real *o, const ks_real *a, int ia, int n) {
+    if (!ia) {
+        ks_real v = mo1(c, a[0]);
+        for (int i = 0; i < n; i++) o[i] = v;
+        return;
+    }
+    if (acc == KS_FAST && strchr(KS_FAST_MO, c)) {
+        double t[KS_MO_BLOCK];
+        for (int i0 = 0; i0 < n; i0 += KS_MO_BLOCK) {
+            int cnt = n - i0 < KS_MO_BLOCK ? n - i0 : KS_MO_BLOCK;
+            mo_fast(c, t, a + i0, cnt);
+            for (int i = 0; i < cnt; i++) o[i0 + i] = t[i];
+        }
+        return;
+    }
+    switch (c) {
+    case 's': for (int i = 0; i < n; i++) o[i] = sin(a[i]); break;
+    case 'c': for (int i = 0; i < n; i++) o[i] = cos(a[i]); break;
+    case 't': for (int i = 0; i < n; i++) o[i] = tan(a[i]); break;
+    case 'h': for (int i = 0; i < n; i++) o[i] = tanh(a[i]); break;
+    case 'a': for (int i = 0; i < n; i++) o[i] = fabs(a[i]); break;
+    case 'q': for (int i = 0; i < n; i++) o[i] = sqrt(fabs(a[i])); break;
+    case '_': for (int i = 0; i < n; i++) o[i] = floor(a[i]); break;
+    default:  for (int i = 0; i < n; i++) o[i] = mo1(c, a[i]); break;
+    }
+}
+
+typedef struct {
+    char c;
+    ks_accuracy acc;
+    ks_real *o;
+    const ks_real *a;
+    double scale;        /* mo_scale_chunk */
+} ks_mo_job;
+
+static void mo_chunk(void *arg, int t, int i0, int i1) {
+    (void)t;
+    ks_mo_job *j = arg;
+    mo_kernel(j->c, j->acc, j->o + i0, j->a + i0, 1, i1 - i0);
+}
+
+static void mo_scale_chunk(void *arg, int t, int i0, int i1) {
+    (void)t;
+    ks_mo_job *j = arg;
+    for (int i = i0; i < i1; i++) j->o[i] = j->a[i] * j->scale;
+}
+
+/* --- Reductions ---
+ * Monadic `+` (sum), `>` (peak magnitude) and the peak search of `w`
+ * fold fixed segments of KS_PAR_MIN elements, side by side when the
+ * context has threads, and then the segment results in order. A sum
+ * up to KS_PAR_MIN long is the plain serial sum, and a longer one is
+ * the same whatever the thread count or par_min. */
+
+typedef struct {
+    char op;             /* '+' sum, '>' largest magnitude */
+    int n, segs, tasks;
+    const ks_real *a;
+    double *part;
+} ks_reduce_job;
+
+static void reduce_task(void *arg, int t) {
+    ks_reduce_job *j = arg;
+    int g1 = (int)((long long)j->segs * (t + 1) / j->tasks);
+    for (int g = (int)((long long)j->segs * t / j->tasks); g < g1; g++) {
+        const ks_real *a = j->a + (size_t)g * KS_PAR_MIN;
+        int len = j->n - g * KS_PAR_MIN < KS_PAR_MIN ? j->n - g * KS_PAR_MIN : KS_PAR_MIN;
+        double r = 0;
+        if (j->op == '+') for (int i = 0; i < len; i++) r += a[i];
+        else for (int i = 0; i < len; i++) if (fabs(a[i]) > r) r = fabs(a[i]);
+        j->part[g] = r;
+    }
+}
+
+static double reduce(ks_ctx *ctx, char op, const ks_real *a, int n) {
+    ks_reduce_job j = { op, n, (n + KS_PAR_MIN - 1) / KS_PAR_MIN, 1, a, NULL };
+    if (j.segs == 0) return 0;
+    char *mark = ctx->arena_ptr;
+    j.part = arena_alloc(ctx, j.segs * sizeof(double));
+    j.tasks = par_tasks(ctx, n);
+    if (j.tasks > j.segs) j.tasks = j.segs;
+    par_run(ctx, j.tasks, reduce_task, &j);
+    double r = 0;
+    for (int g = 0; g < j.segs; g++)
+        if (op == '+') r += j.part[g];
+        else if (j.part[g] > r) r = j.part[g];
+    ctx->arena_ptr = mark;
+    return r;
+}
+
+/* --- Noise ---
+ * `r` draws from a counter-based generator: sample k of a context's
+ * stream is the SplitMix64 output function applied to key + k times
+ * the golden-ratio increment, where key is the mixed seed. A value
+ * depends only on its position, so a fill carries no state from one
+ * sample to the next and vectorises, and a stream replays exactly
+ * from its seed. The top 52 bits go straight into the mantissa of a
+ * double in [2, 4), which is shifted down to [-1, 1). */
+
+#define KS_RNG_STEP 0x9e3779b97f4a7c15ULL
+
+static inline uint64_t rng_mix(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static void rng_fill(ks_ctx *ctx, ks_real *o, int n) {
+    uint64_t z = rng_mix(ctx->rng_seed) + (ctx->rng_ctr + 1) * KS_RNG_STEP;
+    for (int i = 0; i < n; i++)
+        o[i] = fast_real((rng_mix(z + (uint64_t)i * KS_RNG_STEP) >> 12) | 0x4000000000000000ULL) - 3.0;
+    ctx->rng_ctr += (uint64_t)n;
+}
+
+void ks_seed(ks_ctx *ctx, uint64_t seed) {
+    if (!ctx) return;
+    ctx->rng_seed = seed;
+    ctx->rng_ctr = 0;
+}
+
+/* --- Buzz ---
+ * `b` sums six square waves at inharmonic ratios of its pitch. Each
+ * partial is a 32-bit phase accumulator: sample i sits at phase
+ * i * inc mod 2^32, so a block starts anywhere without stepping
+ * through the ones before it, and the sign of sin(phase) is read off
+ * the top bit. Partials add into a block one at a time, which keeps
+ * every loop straight integer arithmetic that vectorises across
+ * samples. A zero phase reads as -1, as sin(0) > 0 is false.
+ *
+ * With PolyBLEP each edge is smoothed by a two-sample polynomial
+ * residual, and partials at or above Nyquist are left out. */
+
+#define KS_BUZZ_N 6
+
+static const double ks_buzz_ratio[KS_BUZZ_N] = {2.43, 3.01, 3.52, 4.11, 5.23, 6.78};
+
+/* Phase step of f Hz in 2^-32 cycles; NaN and inf give 0 (-1 forever,
+   as the sign of sin(NaN) was). */
+static uint32_t buzz_inc(double f) {
+    double r = fmod(f / 44100.0, 1.0);
+    if (!(r >= 0.0)) return 0;
+    return (uint32_t)(uint64_t)(r * 4294967296.0 + 0.5);
+}
+
+/* Residual of a unit step at phase t, for a step of dt per sample. */
+static inline double buzz_blep(double t, double dt) {
+    if (t < dt) { t /= dt; return t + t - t * t - 1.0; }
+    if (t > 1.0 - dt) { t = (t - 1.0) / dt; return t * t + t + t + 1.0; }
+    return 0.0;
+}
+
+static void buzz_fill(ks_real *o, int n, double freq, int blep) {
+    double acc[KS_MO_BLOCK];
+    for (int i0 = 0; i0 < n; i0 += KS_MO_BLOCK) {
+        int m = n - i0 < KS_MO_BLOCK ? n - i0 : KS_MO_BLOCK;
+        for (int k = 0; k < m; k++) acc[k] = 0.0;
+        for (int j = 0; j < KS_BUZZ_N; j++) {
+            double f = freq * ks_buzz_ratio[j];
+            uint32_t inc = buzz_inc(f);
+            uint32_t ph0 = (uint32_t)i0 * inc;
+            if (!blep) {
+                for (int k = 0; k < m; k++) {
+                    uint32_t ph = ph0 + (uint32_t)k * inc;
+                    acc[k] += 1.0 - 2.0 * (int)((ph - 1u) >> 31);
+                }
+                continue;
+            }
+            if (!(f < 22050.0) || inc == 0) continue;
+            double dt = inc * 0x1p-32;
+            for (int k = 0; k < m; k++) {
+                uint32_t ph = ph0 + (uint32_t)k * inc;
+                acc[k] += 1.0 - 2.0 * (int)(ph >> 31)
+                        + buzz_blep(ph * 0x1p-32, dt)
+                        - buzz_blep((uint32_t)(ph + 0x80000000u) * 0x1p-32, dt);
+            }
+        }
+        for (int k = 0; k < m; k++) o[i0 + k] = acc[k] / KS_BUZZ_N;
+    }
+}
+
+/* --- Wavetables ---
+ * `T t freq dur` reads T as one cycle. Once freq times T's top
+ * harmonic (len/2) passes Nyquist, those harmonics fold back, so `t`
+ * reads a band-limited copy instead: T rebuilt from its own harmonics
+ * 0 .. H, where H = 22050/|freq| is the highest that still fits.
+ * Nothing below Nyquist is lost or attenuated. The first time the
+ * context plays a table that high it works out the table's spectrum
+ * with an FFT (Bluestein's chirp for lengths that are not a power of
+ * two) and keeps it; each H then costs one inverse FFT. A copy is the
+ * power of two at or above the table's length, and never shorter than
+ * KS_WTAB_FLOOR samples, so linear interpolation reads it as closely
+ * as a long table. Each table keeps its last KS_WTAB_COPIES copies.
+ * Tables are matched on their contents, not their address, and
+ * pitches that cannot alias read the table itself and never touch the
+ * cache.
+ *
+ * Each copy is stored with one sample of wrap before and three after,
+ * so interpolation reads idx-1 .. idx+2 without a modulo. The phase of
+ * a block is reduced once and steps on from there. */
+
+#define KS_WTAB_SLOTS  8
+#define KS_WTAB_COPIES 4
+#define KS_WTAB_FLOOR  2048  /* Shortest band-limited copy */
+#define KS_WTAB_PAD    4     /* f[-1] and f[n .. n+2] wrap around */
+
+typedef struct {
+    unsigned hash;
+    int n, m;                     /* Table and copy lengths */
+    ks_real *src;                 /* The table, to match it on */
+    double *re, *im;              /* Its spectrum, bins 0 .. n/2 */
+    int harm[KS_WTAB_COPIES];     /* Harmonics kept in each copy, -1 unused */
+    ks_real *f[KS_WTAB_COPIES];   /* The copies, past the front pad */
+    int next;                     /* Copy to replace next */
+    void *data;                   /* NULL when the slot is empty */
+    size_t bytes;
+} ks_wtab_ent;
+
+struct ks_wtabs {
+    ks_wtab_ent e[KS_WTAB_SLOTS];
+    size_t bytes;
+};
+
+static unsigned wt_hash(const ks_real *f, int n) {
+    unsigned h = 2166136261u;
+    const unsigned char *b = (const unsigned char *)f;
+    for (size_t i = 0; i < n * sizeof *f; i++) h = (h ^ b[i]) * 16777619u;
+    return h;
+}
+
+static void wt_pad(ks_real *f, int n) {
+    f[-1] = f[n - 1];
+    for (int j = 0; j < 3; j++) f[n + j] = f[j % n];
+}
+
+/* In-place complex FFT of power-of-two length n; sign -1 forward, +1
+   inverse (unscaled). w holds n/2 twiddles, cos and sin of 2 pi k/n. */
+static void fft2(double *re, double *im, int n, int sign, const double *wc, const double *ws) {
+    for (int i = 1, j = 0; i < n; i++) {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j |= bit;
+        if (i < j) {
+            double t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+    for (int len = 2; len <= n; len <<= 1) {
+        int h = len >> 1, step = n / len;
+        for (int i = 0; i < n; i += len)
+            for (int k = 0; k < h; k++) {
+                double wr = wc[k * step], wi = sign * ws[k * step];
+                double xr = re[i + k + h] * wr - im[i + k + h] * wi;
+                double xi = re[i + k + h] * wi + im[i + k + h] * wr;
+                re[i + k + h] = re[i + k] - xr; im[i + k + h] = im[i + k] - xi;
+                re[i + k] += xr; im[i + k] += xi;
+            }
+    }
+}
+
+static void fft_twiddles(double *wc, double *ws, int n) {
+    for (int k = 0; k < n / 2; k++) {
+        wc[k] = cos(2.0 * M_PI * k / n);
+        ws[k] = sin(2.0 * M_PI * k / n);
+    }
+}
+
+/* The same for any length, through Bluestein's chirp: a length-n DFT
+   is a convolution, done with power-of-two FFTs. 0 if out of memory. */
+static int fft_any(double *re, double *im, int n, int sign) {
+    int pow2 = !(n & (n - 1)), m = n;
+    if (!pow2) for (m = 1; m < 2 * n - 1; m <<= 1) ;
+    double *t = malloc(((size_t)m + (pow2 ? 0 : (size_t)4 * m + 2 * n)) * sizeof(double));
+    if (!t) return 0;
+    double *wc = t, *ws = wc + m / 2;
+    fft_twiddles(wc, ws, m);
+    if (pow2) { fft2(re, im, n, sign, wc, ws); free(t); return 1; }
+    double *ar = ws + m / 2, *ai = ar + m, *br = ai + m, *bi = br + m, *cr = bi + m, *ci = cr + n;
+    for (int k = 0; k < n; k++) {
+        double u = M_PI * (double)((long long)k * k % (2LL * n)) / n;
+        cr[k] = cos(u); ci[k] = sign * sin(u);
+    }
+    memset(ar, 0, (size_t)4 * m * sizeof(double));
+    for (int k = 0; k < n; k++) {
+        ar[k] = re[k] * cr[k] - im[k] * ci[k];
+        ai[k] = re[k] * ci[k] + im[k] * cr[k];
+        br[k] = cr[k]; bi[k] = -ci[k];
+        if (k) { br[m - k] = cr[k]; bi[m - k] = -ci[k]; }
+    }
+    fft2(ar, ai, m, -1, wc, ws);
+    fft2(br, bi, m, -1, wc, ws);
+    for (int k = 0; k < m; k++) {
+        double xr = ar[k] * br[k] - ai[k] * bi[k];
+        ai[k] = ar[k] * bi[k] + ai[k] * br[k];
+        ar[k] = xr;
+    }
+    fft2(ar, ai, m, 1, wc, ws);
+    for (int k = 0; k < n; k++) {
+        double xr = ar[k] / m, xi = ai[k] / m;
+        re[k] = xr * cr[k] - xi * ci[k];
+        im[k] = xr * ci[k] + xi * cr[k];
+    }
+    free(t);
+    return 1;
+}
+
+/* Bins 0 .. n/2 of the n-sample cycle src. 0 if out of memory. */
+static int wt_spectrum(double *re, double *im, const ks_real *src, int n) {
+    double *t = malloc((size_t)2 * n * sizeof(double));
+    if (!t) return 0;
+    double *xr = t, *xi = t + n;
+    for (int j = 0; j < n; j++) { xr[j] = src[j]; xi[j] = 0; }
+    int ok = fft_any(xr, xi, n, -1);
+    for (int k = 0; ok && k <= n / 2; k++) { re[k] = xr[k] / n; im[k] = xi[k] / n; }
+    free(t);
+    return ok;
+}
+
+/* dst (m samples, a power of two) = harmonics 0 .. harm of e's table.
+   harm < n/2, so the Nyquist bin never comes in. 0 if out of memory. */
+static int wt_synth(ks_real *dst, const ks_wtab_ent *e, int harm) {
+    int m = e->m;
+    double *t = calloc((size_t)2 * m, sizeof(double));
+    if (!t) return 0;
+    double *yr = t, *yi = t + m;
+    yr[0] = e->re[0];
+    for (int k = 1; k <= harm; k++) {
+        yr[k] = e->re[k]; yi[k] = e->im[k];
+        yr[m - k] = e->re[k]; yi[m - k] = -e->im[k];
+    }
+    int ok = fft_any(yr, yi, m, 1);
+    for (int j = 0; ok && j < m; j++) dst[j] = yr[j];
+    free(t);
+    return ok;
+}
+
+static void wt_drop(struct ks_wtabs *w, ks_wtab_ent *e) {
+    if (!e->data) return;
+    w->bytes -= e->bytes;
+    free(e->data);
+    e->data = NULL;
+}
+
+static void wt_free(ks_ctx *ctx) {
+    if (!ctx->wtabs) return;
+    for (int i = 0; i < KS_WTAB_SLOTS; i++) wt_drop(ctx->wtabs, &ctx->wtabs->e[i]);
+    free(ctx->wtabs);
+    ctx->wtabs = NULL;
+}
+
+/* The copy of table a with harmonics 0 .. harm (length e->m), built
+   on first sight; NULL when it cannot be kept (out of memory, or over
+   mem_limit in total). */
+static ks_real *wt_get(ks_ctx *ctx, K a, int harm, int *m) {
+    int n = a->n;
+    unsigned h = wt_hash(a->f, n);
+    if (!ctx->wtabs && !(ctx->wtabs = calloc(1, sizeof(struct ks_wtabs)))) return NULL;
+    struct ks_wtabs *w = ctx->wtabs;
+    ks_wtab_ent *e = &w->e[h % KS_WTAB_SLOTS];
+    if (!(e->data && e->hash == h && e->n == n &&
+          memcmp(e->src, a->f, n * sizeof(ks_real)) == 0)) {
+        wt_drop(w, e);
+        int len = KS_WTAB_FLOOR;
+        while (len < n) len <<= 1;
+        size_t bytes = n * sizeof(ks_real) + (size_t)2 * (n / 2 + 1) * sizeof(double) +
+                       (size_t)KS_WTAB_COPIES * (len + KS_WTAB_PAD) * sizeof(ks_real);
+        if (w->bytes + bytes > ctx->mem_limit || !(e->data = malloc(bytes))) return NULL;
+        e->re = e->data;
+        e->im = e->re + n / 2 + 1;
+        e->src = (ks_real *)(e->im + n / 2 + 1);
+        memcpy(e->src, a->f, n * sizeof(ks_real));
+        if (!wt_spectrum(e->re, e->im, a->f, n)) { free(e->data); e->data = NULL; return NULL; }
+        ks_real *f = e->src + n + 1;
+        for (int c = 0; c < KS_WTAB_COPIES; c++, f += len + KS_WTAB_PAD) {
+            e->f[c] = f;
+            e->harm[c] = -1;
+        }
+        e->hash = h;
+        e->n = n;
+        e->m = len;
+        e->next = 0;
+        e->bytes = bytes;
+        w->bytes += bytes;
+    }
+    *m = e->m;
+    for (int c = 0; c < KS_WTAB_COPIES; c++)
+        if (e->harm[c] == harm) return e->f[c];
+    int c = e->next;
+    e->harm[c] = -1;
+    if (!wt_synth(e->f[c], e, harm)) return NULL;
+    wt_pad(e->f[c], e->m);
+    e->harm[c] = harm;
+    e->next = (c + 1) % KS_WTAB_COPIES;
+    return e->f[c];
+}
+
+/* n_out samples of the padded n-sample table f at freq Hz. */
+static void wt_read(ks_real *o, int n_out, const ks_real *f, int n, double freq, int cubic) {
+    int ix[KS_MO_BLOCK];
+    double fr[KS_MO_BLOCK];
+    double inc = fmod(freq * n / 44100.0, (double)n);
+    if (!isfinite(inc)) inc = 0.0;
+    double inv = 1.0 / n;
+    for (int i0 = 0; i0 < n_out; i0 += KS_MO_BLOCK) {
+        int m = n_out - i0 < KS_MO_BLOCK ? n_out - i0 : KS_MO_BLOCK;
+        /* reduce once per block; stepping backwards starts far enough
+           up that the block stays non-negative */
+        double base = fmod((double)i0 * inc, (double)n);
+        if (base < 0) base += n;
+        if (inc < 0) base += n * ceil(-inc * KS_MO_BLOCK * inv);
+        for (int k = 0; k < m; k++) {
+            double pos = base + k * inc;
+            pos -= n * (double)(int)(pos * inv);
+            ix[k] = (int)pos;
+            fr[k] = pos - ix[k];
+        }
+        /* gather into fr, which cannot alias the table */
+        if (!cubic) {
+            for (int k = 0; k < m; k++)
+                fr[k] = f[ix[k]] * (1.0 - fr[k]) + f[ix[k] + 1] * fr[k];
+        } else {
+            for (int k = 0; k < m; k++) {
+                double x = fr[k];
+                double p0 = f[ix[k] - 1], p1 = f[ix[k]], p2 = f[ix[k] + 1], p3 = f[ix[k] + 2];
+                fr[k] = p1 + 0.5 * x * (p2 - p0 + x * (2.0 * p0 - 5.0 * p1 + 4.0 * p2 - p3 +
+                                                     x * (3.0 * (p1 - p2) + p3 - p0)));
+            }
+        }
+        for (int k = 0; k < m; k++) o[i0 + k] = fr[k];
+    }
+}
+
+/* --- Filters ---
+ * `ct rs L f V` and `hz q L g V` treat V as L interleaved channels,
+ * the layout `z` builds, and give each its own filter state. A single
+ * filter is one long dependency chain, so the lanes run side by side:
+ * the state sits in arrays across KS_FILT_LANES lanes and every frame
+ * steps all of them at once. Coefficients are fixed, and each lane
+ * gets exactly what a lone filter with them would give. A V whose
+ * length is not a multiple of L ends in a partial frame.
+ *
+ * `g` with a fixed cutoff works its coefficient out once. A swept
+ * cutoff (one Hz value per sample) takes a sin per sample, which
+ * overlaps the filter's own dependency chain. At a control rate k > 1
+ * a coefficient is instead worked out every k samples from a
+ * quarter-wave table and interpolated linearly between. That is
+ * within 1e-6 of the exact map and drops k-1 of every k sines.
+ *
+ * Clamping the state every sample puts its compares on that chain.
+ * Under a wider clamp span (the context's NaN policy) the filters run
+ * a span at a time unclamped, clamp the state between spans, and clamp
+ * the output in one vectorised pass at the end. */
+
+#define KS_FILT_LANES 8
+#define KS_SIN_TAB    1024  /* Quarter-wave table intervals */
+
+/* Samples per clamp run for a filter over frames of `frame` samples:
+   a whole number of frames, or all n when clamping every step. */
+static int clamp_run_len(int span, int frame, int n) {
+    if (span == 1 || span >= n) return n > 0 ? n : 1;
+    return (span + frame - 1) / frame * frame;
+}
+
+/* `f`: two-pole lowpass with resonance fed back from the output. */
+static void lp2_lanes(ks_real *o, const ks_real *v, int n, int lanes, double ct, double rs, int span) {
+    if (ct > 0.95) ct = 0.95;
+    if (rs > 3.98) rs = 3.98;
+    int each = span == 1, run = clamp_run_len(span, lanes, n);
+    for (int g = 0; g < lanes; g += KS_FILT_LANES) {
+        int w = lanes - g < KS_FILT_LANES ? lanes - g : KS_FILT_LANES;
+        double b0[KS_FILT_LANES] = {0}, b1[KS_FILT_LANES] = {0};
+        for (int r0 = g, r1; r0 < n; r0 = r1) {
+            r1 = n - r0 > run ? r0 + run : n;
+            for (int i = r0; i < r1; i += lanes) {
+                int m = n - i < w ? n - i : w;
+                for (int l = 0; l < m; l++) {
+                    double in = v[i + l] - rs * b1[l];
+                    b0[l] += ct * (in - b0[l]); b1[l] += ct * (b0[l] - b1[l]);
+                    if (each) { b0[l] = safe_step(b0[l]); b1[l] = safe_step(b1[l]); }
+                    o[i + l] = b1[l];
+                }
+            }
+            for (int l = 0; l < w; l++) { b0[l] = safe_val(b0[l]); b1[l] = safe_val(b1[l]); }
+        }
+    }
+    if (!each) safe_run(o, n);
+}
+
+/* `g` coefficient for a cutoff in Hz. */
+static inline double svf_coeff(double hz) {
+    double f = 2.0 * sin(M_PI * hz / 44100.0);
+    return f > 1.99 ? 1.99 : f;
+}
+
+/* The context's quarter-wave table, built on first use; NULL when
+   out of memory. */
+static const double *sin_table(ks_ctx *ctx) {
+    if (!ctx->sin_tab && (ctx->sin_tab = malloc((KS_SIN_TAB + 1) * sizeof(double))))
+        for (int i = 0; i <= KS_SIN_TAB; i++)
+            ctx->sin_tab[i] = sin(0.5 * M_PI * i / KS_SIN_TAB);
+    return ctx->sin_tab;
+}
+
+/* svf_coeff through the table: sin(pi x) with x reduced to a quarter
+   wave, linearly interpolated. */
+static double svf_tab_coeff(const double *tab, double hz) {
+    double x = hz / 44100.0, sg = 2.0;
+    if (!(fabs(x) < 1e9)) return svf_coeff(hz);
+    x -= 2.0 * floor(x * 0.5);
+    if (x >= 1.0) { x -= 1.0; sg = -2.0; }
+    if (x > 0.5) x = 1.0 - x;
+    double p = x * (2 * KS_SIN_TAB);
+    int i = (int)p;
+    if (i >= KS_SIN_TAB) i = KS_SIN_TAB - 1;
+    double f = sg * (tab[i] + (p - i) * (tab[i + 1] - tab[i]));
+    return f > 1.99 ? 1.99 : f;
+}
+
+/* One step of the `g` recursion, lowpass tap to o[i]; the state is
+   clamped when `each` is set. */
+#define SVF_STEP(FC) do {                                   \
+    double hp = v[i] - s0 - damp * s1;                      \
+    s1 += (FC) * hp; s0 += (FC) * s1;                       \
+    if (each) { s0 = safe_step(s0); s1 = safe_step(s1); }   \
+    o[i] = s1;                                              \
+} while (0)
+
+/* `g` with one cutoff in Hz per sample. */
+static void svf_swept(ks_ctx *ctx, ks_real *o, const ks_real *v, const ks_real *hz, int n, double damp, int span) {
+    double s0 = 0.0, s1 = 0.0;
+    int k = ctx->control_rate;
+    const double *tab = k > 1 ? sin_table(ctx) : NULL;
+    int each = span == 1, run = clamp_run_len(span, tab ? k : 1, n);
+    for (int r0 = 0, r1; r0 < n; r0 = r1) {
+        r1 = n - r0 > run ? r0 + run : n;
+        if (!tab) {
+            for (int i = r0; i < r1; i++) SVF_STEP(svf_coeff(hz[i]));
+        } else {
+            for (int i0 = r0; i0 < r1; i0 += k) {
+                int to = i0 + k < n ? i0 + k : n - 1;
+                double c = svf_tab_coeff(tab, hz[i0]);
+                double dc = to > i0 ? (svf_tab_coeff(tab, hz[to]) - c) / (to - i0) : 0.0;
+                int end = i0 + k < n ? i0 + k : n;
+                for (int i = i0; i < end; i++, c += dc) SVF_STEP(c);
+            }
+        }
+        s0 = safe_val(s0); s1 = safe_val(s1);
+    }
+    if (!each) safe_run(o, n);
+}
+
+/* `g`: Chamberlin state variable filter, lowpass tap. */
+static void svf_lanes(ks_real *o, const ks_real *v, int n, int lanes, double fc, double damp, int span) {
+    int each = span == 1, run = clamp_run_len(span, lanes, n);
+    if (lanes == 1) {   /* keep the state in registers */
+        double s0 = 0.0, s1 = 0.0;
+        for (int r0 = 0, r1; r0 < n; r0 = r1) {
+            r1 = n - r0 > run ? r0 + run : n;
+            for (int i = r0; i < r1; i++) SVF_STEP(fc);
+            s0 = safe_val(s0); s1 = safe_val(s1);
+        }
+        if (!each) safe_run(o, n);
+        return;
+    }
+    for (int g = 0; g < lanes; g += KS_FILT_LANES) {
+        int w = lanes - g < KS_FILT_LANES ? lanes - g : KS_FILT_LANES;
+        double s0[KS_FILT_LANES] = {0}, s1[KS_FILT_LANES] = {0};
+        for (int r0 = g, r1; r0 < n; r0 = r1) {
+            r1 = n - r0 > run ? r0 + run : n;
+            for (int i = r0; i < r1; i += lanes) {
+                int m = n - i < w ? n - i : w;
+                for (int l = 0; l < m; l++) {
+                    double hp = v[i + l] - s0[l] - damp * s1[l];
+                    s1[l] += fc * hp; s0[l] += fc * s1[l];
+                    if (each) { s0[l] = safe_step(s0[l]); s1[l] = safe_step(s1[l]); }
+                    o[i + l] = s1[l];
+                }
+            }
+            for (int l = 0; l < w; l++) { s0[l] = safe_val(s0[l]); s1[l] = safe_val(s1[l]); }
+        }
+    }
+    if (!each) safe_run(o, n);
+}
+
+/* --- Delays ---
+ * `d g y V` feeds the output back d samples later. A sample depends
+ * only on the one d before it, so the output is built d samples at a
+ * time: each block is a multiply-add against the finished block before
+ * it, clamped as it is written, which vectorises. Blocks are cut to
+ * KS_MO_BLOCK. Delays below one sample are taken as one. Shorter
+ * delays go a sample at a time and clamp as often as the context's
+ * NaN policy asks.
+ *
+ * `d1 g1 d2 g2 ... y V` sums several feedback taps into one output.
+ * Tap delays may be fractional and are read with linear interpolation,
+ * so blocks run as long as the shortest whole delay. */
+
+#define KS_MAX_TAPS        32
+#define KS_DELAY_MIN_BLOCK 16   /* Shorter delays go a sample at a time */
+
+/* out[i] = V[i] + g out[i-d]. */
+static void delay1(ks_real *o, const ks_real *v, int n, int d, double g, int span) {
+    int m = d < n ? d : n;
+    for (int i = 0; i < m; i++) o[i] = safe_val(v[i] + g * 0.0);
+    if (d < KS_DELAY_MIN_BLOCK) {
+        if (span == 1) {
+            for (int i = d; i < n; i++) o[i] = safe_step(v[i] + g * o[i - d]);
+            return;
+        }
+        for (int r0 = d, r1; r0 < n; r0 = r1) {
+            r1 = n - r0 > span ? r0 + span : n;
+            for (int i = r0; i < r1; i++) o[i] = v[i] + g * o[i - d];
+            safe_run(o + r0, r1 - r0);
+        }
+        return;
+    }
+    int step = d < KS_MO_BLOCK ? d : KS_MO_BLOCK;
+    for (int i0 = d; i0 < n; i0 += step) {
+        int len = n - i0 < step ? n - i0 : step;
+        ks_real *y = o + i0;
+        const ks_real *back = o + i0 - d;
+        for (int k = 0; k < len; k++) y[k] = safe_val(v[i0 + k] + g * back[k]);
+    }
+}
+
+/* out[i] = V[i] + sum of g_t out[i - d_t], d_t fractional. */
+static void delay_taps(ks_real *o, const ks_real *v, int n, const ks_real *tap, int taps, int span) {
+    int di[KS_MAX_TAPS];
+    double fr[KS_MAX_TAPS], gn[KS_MAX_TAPS];
+    int step = n < KS_MO_BLOCK ? n : KS_MO_BLOCK;
+    for (int t = 0; t < taps; t++) {
+        double d = tap[2 * t];
+        if (!(d >= 1.0)) d = 1.0;
+        if (d > n) d = n;
+        di[t] = (int)d;
+        fr[t] = d - di[t];
+        gn[t] = tap[2 * t + 1];
+        if (di[t] < step) step = di[t];
+    }
+    int c0 = 0;   /* o[c0..] not clamped yet */
+    for (int i0 = 0; i0 < n; i0 += step) {
+        int len = n - i0 < step ? n - i0 : step;
+        ks_real *y = o + i0;
+        for (int k = 0; k < len; k++) y[k] = v[i0 + k];
+        for (int t = 0; t < taps; t++) {
+            /* out[i-d] and out[i-d-1] with weights 1-fr and fr; reads
+               before the start are zero */
+            double w0 = gn[t] * (1.0 - fr[t]), w1 = gn[t] * fr[t];
+            int k0 = di[t] - i0, k1 = di[t] + 1 - i0;
+            if (k0 < 0) k0 = 0;
+            if (k1 < 0) k1 = 0;
+            if (k0 > len) k0 = len;
+            if (k1 > len) k1 = len;
+            const ks_real *back = o + i0 - di[t];
+            for (int k = k0; k < k1; k++) y[k] += w0 * back[k];
+            for (int k = k1; k < len; k++) y[k] += w0 * back[k] + w1 * back[k - 1];
+        }
+        if (step >= KS_DELAY_MIN_BLOCK)
+            safe_run(y, len);
+        else if (span == 1)
+            for (int k = 0; k < len; k++) y[k] = safe_step(y[k]);
+        else if (i0 + len - c0 >= span || i0 + len == n) {
+            safe_run(o + c0, i0 + len - c0);
+            c0 = i0 + len;
+        }
+    }
+}
+
+/* --- Additive Kernels ---
+ * `P $ A` is the sum over k of A[k-1] sin(k P[i]). Instead of a sin
+ * per harmonic, the Clenshaw recurrence
+ *     b_k = A[k-1] + 2 cos(P) b_{k+1} - b_{k+2}
+ * gives it as b_1 sin(P), so each sample needs one sin and one cos
+ * and then m multiply-adds. Samples run side by side in blocks, which
+ * lets the recurrence vectorise across them. Its rounding grows like
+ * m^2 ulp of sum |A|, while the per-harmonic sum rounds k P before
+ * every sin; the two agree to about 1e-11 at 512 harmonics.
+ *
+ * `P o H` with whole-number harmonics is the same sum with A counting
+ * each harmonic. Other harmonic sets are summed term by term, with the
+ * fast sin kernel vectorised across samples. */
+
+#define KS_HARM_SPAN 64   /* o: Clenshaw when max |H| <= 4 len(H) + this */
+
+/* sin and cos of cnt phases; huge or non-finite ones go through libm. */
+static void harm_sincos(const ks_real *p, int cnt, double *s, double *c) {
+    for (int i = 0; i < cnt; i++) { s[i] = fast_sin(p[i]); c[i] = fast_cos(p[i]); }
+    for (int i = 0; i < cnt; i++)
+        if (!(fabs(p[i]) <= KS_FAST_TRIG_MAX)) { s[i] = sin(p[i]); c[i] = cos(p[i]); }
+}
+
+/* o[i] = sum over k = 1..m of w[k-1] sin(k p[i]); o may be p. */
+static void harm_sum(ks_real *o, const ks_real *p, int n, const ks_real *w, int m) {
+    double s[KS_MO_BLOCK], c2[KS_MO_BLOCK], b1[KS_MO_BLOCK], b2[KS_MO_BLOCK];
+    for (int i0 = 0; i0 < n; i0 += KS_MO_BLOCK) {
+        int cnt = n - i0 < KS_MO_BLOCK ? n - i0 : KS_MO_BLOCK;
+        harm_sincos(p + i0, cnt, s, c2);
+        for (int i = 0; i < cnt; i++) { c2[i] *= 2.0; b1[i] = b2[i] = 0.0; }
+        for (int k = m; k >= 1; k--) {
+            double a = w[k - 1];
+            for (int i = 0; i < cnt; i++) {
+                double b = a + c2[i] * b1[i] - b2[i];
+                b2[i] = b1[i]; b1[i] = b;
+            }
+        }
+        for (int i = 0; i < cnt; i++) o[i0 + i] = m ? b1[i] * s[i] : 0.0;
+    }
+}
+
+/* o[i] = sum over j of sin(p[i] h[j]), in j order like the plain loop. */
+static void osc_sum(ks_real *o, const ks_real *p, int n, const ks_real *h, int m) {
+    double acc[KS_MO_BLOCK], t[KS_MO_BLOCK];
+    for (int i0 = 0; i0 < n; i0 += KS_MO_BLOCK) {
+        int cnt = n - i0 < KS_MO_BLOCK ? n - i0 : KS_MO_BLOCK;
+        for (int i = 0; i < cnt; i++) acc[i] = 0.0;
+        for (int j = 0; j < m; j++) {
+            double hj = h[j];
+            for (int i = 0; i < cnt; i++) t[i] = fast_sin(p[i0 + i] * hj);
+            for (int i = 0; i < cnt; i++) {
+                double v = p[i0 + i] * hj;
+                if (!(fabs(v) <= KS_FAST_TRIG_MAX)) t[i] = sin(v);
             }
-            case 'b': {
-                /* Monadic b: fixed-pitch buzz at 110 Hz (default organ bass).
-                   For pitched use, prefer dyadic form: freq b V */
-                double ff[] = {2.43, 3.01, 3.52, 4.11, 5.23, 6.78};
-                double phase_inc = 110.0 * (2.0 * M_PI / 44100.0);
-                double ss = 0;
-                for (int j = 0; j < 6; j++)
-                    ss += (sin(i * phase_inc * ff[j]) > 0) ? 1.0 : -1.0;
-                x->f[i] = ss / 6.0;
+            for (int i = 0; i < cnt; i++) acc[i] += t[i];
+        }
+        for (int i = 0; i < cnt; i++) o[i0 + i] = acc[i];
+    }
+}
+
+K mo(ks_ctx *ctx, char c, K b) {
+    if (!b) return NULL;
+
+    K x;
+
+    if (c >= 'A' && c <= 'Z') {
+        K var = ctx->vars[c - 'A'];
+        if (k_is_func(var)) {
+            K call_args[1] = {b};
+            x = k_call(ctx, var, call_args, 1);
+            k_free(ctx, b); return x;
+        }
+    }
+
+    if (c == '!') {
+        int n = (int)b->f[0]; k_free(ctx, b);
+        if (n < 0 || n > 1000000) { ctx->last_status = KS_ERR_INVALID_ARGS; longjmp(ctx->recover, 1); }
+        GAS_CHECK(ctx, n);
+        x = k_new(ctx, n);
+        for (int j = 0; j < n; j++) x->f[j] = (double)j;
+        return x;
+    }
+
+    if (c == '~') {
+        int n = (int)b->f[0]; k_free(ctx, b);
+        if (n < 1 || n > 1000000) return k_new(ctx, 0);
+        GAS_CHECK(ctx, n);
+        x = k_new(ctx, n);
+        double twopi = 2.0 * M_PI;
+        for (int j = 0; j < n; j++) x->f[j] = twopi * (double)j / (double)n;
+        return x;
+    }
+
+    if (c == '+' || c == '>') {
+        GAS_CHECK(ctx, b->n);
+        double t = reduce(ctx, c, b->f, b->n);
+        x = k_new(ctx, 1); x->f[0] = t;
+        k_free(ctx, b); return x;
+    }
+
+    if (c == 'w') {
+        GAS_CHECK(ctx, b->n);
+        double pk = reduce(ctx, '>', b->f, b->n);
+        x = k_reuse(ctx, b);
+        ks_mo_job j = { c, ctx->accuracy, x->f, b->f, (pk > 1e-10) ? 1.0 / pk : 0.0 };
+        par_chunks(ctx, b->n, mo_scale_chunk, &j);
+        k_free(ctx, b); return x;
+    }
+
+    if (c == 'j') {
+        if (b->n < 2) { k_free(ctx, b); return k_new(ctx, 0); }
+        int n = b->n / 2;
+        GAS_CHECK(ctx, n);
+        x = k_new(ctx, n);
+        for (int i = 0; i < x->n; i++) x->f[i] = b->f[i*2];
+        k_free(ctx, b); return x;
+    }
+
+    if (c == 'k') {
+        if (b->n < 2) { k_free(ctx, b); return k_new(ctx, 0); }
+        int n = b->n / 2;
+        GAS_CHECK(ctx, n);
+        x = k_new(ctx, n);
+        for (int i = 0; i < x->n; i++) x->f[i] = b->f[i*2+1];
+        k_free(ctx, b); return x;
+    }
+
+    if (c == 'v') {
+        GAS_CHECK(ctx, b->n);
+        x = k_reuse(ctx, b);
+        for (int i = 0; i < b->n; i++)
+            x->f[i] = floor(b->f[i] * 4.0) / 4.0;
+        k_free(ctx, b); return x;
+    }
+
+    GAS_CHECK(ctx, b->n);
+    if (c == 'r') {
+        x = k_reuse(ctx, b);
+        rng_fill(ctx, x->f, b->n);
+        k_free(ctx, b); return x;
+    }
+    if (c == 'b') {
+        /* Monadic b: fixed-pitch buzz at 110 Hz (default organ bass).
+           For pitched use, prefer dyadic form: freq b V */
+        x = k_reuse(ctx, b);
+        buzz_fill(x->f, b->n, 110.0, 0);
+        k_free(ctx, b); return x;
+    }
+    if (!strchr("imu", c)) {
+        x = k_reuse(ctx, b);
+        ks_mo_job j = { c, ctx->accuracy, x->f, b->f, 0 };
+        par_chunks(ctx, b->n, mo_chunk, &j);
+        k_free(ctx, b); return x;
+    }
+    x = (c == 'i') ? k_new(ctx, b->n) : k_reuse(ctx, b);  /* reversal reads ahead */
+    for (int i = 0; i < b->n; i++) {
+        switch (c) {
+            case 'i': x->f[i] = b->f[b->n - 1 - i]; break;
+            case 'm': {
+                unsigned int clock = i;
+                unsigned int hh = (clock * 13) ^ (clock >> 5) ^ (clock * 193);
+                x->f[i] = (hh & 128) ? 0.7 : -0.7;
                 break;
             }
             case 'u': {
@@ -458,8 +2258,6 @@ K mo(ks_ctx *ctx, char c, K b) {
                 x->f[i] = (i < 10) ? (double)i / 10.0 : 1.0;
                 break;
             }
-            case 'n': x->f[i] = 440.0 * pow(2.0, (v - 69.0) / 12.0); break;
-            default: x->f[i] = v; break;
         }
     }
     k_free(ctx, b); return x;
@@ -468,16 +2266,17 @@ K mo(ks_ctx *ctx, char c, K b) {
 K dy(ks_ctx *ctx, char c, K a, K b) {
     if (!a || !b) { k_free(ctx, a); k_free(ctx, b); return NULL; }
 
+    K x;
+
     if (c >= 'A' && c <= 'Z') {
         K var = ctx->vars[c - 'A'];
         if (k_is_func(var)) {
             K call_args[2] = {a, b};
-            return k_call(ctx, var, call_args, 2);
+            x = k_call(ctx, var, call_args, 2);
+            k_free(ctx, a); k_free(ctx, b); return x;
         }
     }
 
-    K x;
-
     if (c == 'z') {
         int mn = (a->n < b->n) ? a->n : b->n;
         GAS_CHECK(ctx, mn * 2);
@@ -491,12 +2290,25 @@ K dy(ks_ctx *ctx, char c, K a, K b) {
 
     if (c == 'o') {
         GAS_CHECK(ctx, (long long)a->n * b->n);
+        /* whole-number harmonics become Clenshaw weights */
+        int top = 0;
+        for (int j = 0; j < b->n && top >= 0; j++) {
+            double h = fabs(b->f[j]);
+            if (h != floor(h) || h > 4.0 * b->n + KS_HARM_SPAN) top = -1;
+            else if (h > top) top = (int)h;
+        }
         x = k_new(ctx, a->n);
-        for (int i = 0; i < a->n; i++) {
-            double acc = 0.0;
-            for (int j = 0; j < b->n; j++)
-                acc += sin(a->f[i] * b->f[j]);
-            x->f[i] = acc;
+        if (top >= 0) {
+            K w = k_new(ctx, top ? top : 1);
+            memset(w->f, 0, w->n * sizeof(ks_real));
+            for (int j = 0; j < b->n; j++) {
+                int h = (int)b->f[j];
+                if (h) w->f[abs(h) - 1] += h > 0 ? 1 : -1;
+            }
+            harm_sum(x->f, a->f, a->n, w->f, top);
+            k_free(ctx, w);
+        } else {
+            osc_sum(x->f, a->f, a->n, b->f, b->n);
         }
         k_free(ctx, a); k_free(ctx, b); return x;
     }
@@ -504,12 +2316,7 @@ K dy(ks_ctx *ctx, char c, K a, K b) {
     if (c == '$') {
         GAS_CHECK(ctx, (long long)a->n * b->n);
         x = k_new(ctx, a->n);
-        for (int i = 0; i < a->n; i++) {
-            double acc = 0.0;
-            for (int j = 0; j < b->n; j++)
-                acc += b->f[j] * sin(a->f[i] * (double)(j + 1));
-            x->f[i] = acc;
-        }
+        harm_sum(x->f, a->f, a->n, b->f, b->n);
         k_free(ctx, a); k_free(ctx, b); return x;
     }
 
@@ -526,19 +2333,21 @@ K dy(ks_ctx *ctx, char c, K a, K b) {
         int tbl_len = a->n;
         if (n_out < 1 || tbl_len < 1) { k_free(ctx, a); k_free(ctx, b); return k_new(ctx, 0); }
 
+        int cubic = b->n >= 3 && b->f[2] != 0;
+
         GAS_CHECK(ctx, n_out);
-        double phase_inc = freq_hz * (double)tbl_len / 44100.0;
-        double phase     = 0.0;
         x = k_new(ctx, n_out);
-
-        for (int i = 0; i < n_out; i++) {
-            while (phase >= tbl_len) phase -= tbl_len;
-            while (phase <  0.0)    phase += tbl_len;
-            int    idx  = (int)phase;
-            double frac = phase - idx;
-            int    idx2 = (idx + 1) % tbl_len;
-            x->f[i] = a->f[idx] * (1.0 - frac) + a->f[idx2] * frac;
-            phase += phase_inc;
+        int m = 0;
+        ks_real *bl = fabs(freq_hz) * (tbl_len / 2.0) > 22050.0
+                    ? wt_get(ctx, a, (int)(22050.0 / fabs(freq_hz)), &m) : NULL;
+        if (bl) {
+            wt_read(x->f, n_out, bl, m, freq_hz, cubic);
+        } else {
+            K pad = k_new(ctx, tbl_len + KS_WTAB_PAD);
+            memcpy(pad->f + 1, a->f, tbl_len * sizeof(ks_real));
+            wt_pad(pad->f + 1, tbl_len);
+            wt_read(x->f, n_out, pad->f + 1, tbl_len, freq_hz, cubic);
+            k_free(ctx, pad);
         }
         k_free(ctx, a); k_free(ctx, b); return x;
     }
@@ -546,28 +2355,23 @@ K dy(ks_ctx *ctx, char c, K a, K b) {
     if (c == 'v') {
         double levels = (a->n > 0 && a->f[0] > 0) ? a->f[0] : 4.0;
         GAS_CHECK(ctx, b->n);
-        x = k_new(ctx, b->n);
+        x = k_reuse(ctx, b);
         for (int i = 0; i < b->n; i++)
             x->f[i] = floor(b->f[i] * levels) / levels;
         k_free(ctx, a); k_free(ctx, b); return x;
     }
 
     if (c == 'b') {
-        /* Dyadic b: freq b signal — pitched band-limited buzz at freq Hz.
+        /* Dyadic b: freq b signal — pitched buzz at freq Hz.
            Same 6-oscillator metallic cluster as monadic b, tuned to freq.
+           (freq,1) b signal smooths the edges with PolyBLEP.
            Output length = b->n (the signal vector). */
         double freq = (a->n > 0) ? a->f[0] : 110.0;
+        int blep = a->n > 1 && a->f[1] != 0;
         if (freq < 1.0) freq = 1.0;
-        double phase_inc = freq * (2.0 * M_PI / 44100.0);
-        double ff[] = {2.43, 3.01, 3.52, 4.11, 5.23, 6.78};
         GAS_CHECK(ctx, b->n);
-        x = k_new(ctx, b->n);
-        for (int i = 0; i < b->n; i++) {
-            double ss = 0;
-            for (int j = 0; j < 6; j++)
-                ss += (sin(i * phase_inc * ff[j]) > 0) ? 1.0 : -1.0;
-            x->f[i] = ss / 6.0;
-        }
+        x = k_reuse(ctx, b);
+        buzz_fill(x->f, b->n, freq, blep);
         k_free(ctx, a); k_free(ctx, b); return x;
     }
 
@@ -577,7 +2381,7 @@ K dy(ks_ctx *ctx, char c, K a, K b) {
            N < 1 is treated as 1; use N=0 to effectively bypass. */
         int ramp = (a->n > 0 && a->f[0] >= 1.0) ? (int)a->f[0] : 1;
         GAS_CHECK(ctx, b->n);
-        x = k_new(ctx, b->n);
+        x = k_reuse(ctx, b);
         for (int i = 0; i < b->n; i++)
             x->f[i] = (i < ramp) ? (double)i / (double)ramp : 1.0;
         k_free(ctx, a); k_free(ctx, b); return x;
@@ -585,48 +2389,60 @@ K dy(ks_ctx *ctx, char c, K a, K b) {
 
     if (c == 'f') {
         GAS_CHECK(ctx, b->n);
-        x = k_new(ctx, b->n); double b0 = 0, b1 = 0;
-        for (int i = 0; i < b->n; i++) {
-            double ct = (a->n > i) ? a->f[i] : a->f[0];
-            double rs = (a->n >= 2) ? a->f[1] : 0.0;
-            if (ct > 0.95) ct = 0.95;
-            if (rs > 3.98) rs = 3.98;
-            double in = b->f[i] - (rs * b1);
-            b0 += ct * (in - b0); b1 += ct * (b0 - b1);
+        if (a->n == 3 && b->n > 3 && a->f[2] >= 1) {
+            x = k_reuse(ctx, b);
+            lp2_lanes(x->f, b->f, b->n, (int)fmin(a->f[2], b->n), a->f[0], a->f[1], clamp_span(ctx, b->n));
+            k_free(ctx, a); k_free(ctx, b); return x;
+        }
+        x = k_reuse(ctx, b); double b0 = 0, b1 = 0;
+        int span = clamp_span(ctx, b->n), each = span == 1;
+        int run = clamp_run_len(span, 1, b->n);
+        for (int r0 = 0, r1; r0 < b->n; r0 = r1) {
+            r1 = b->n - r0 > run ? r0 + run : b->n;
+            for (int i = r0; i < r1; i++) {
+                double ct = (a->n > i) ? a->f[i] : a->f[0];
+                double rs = (a->n >= 2) ? a->f[1] : 0.0;
+                if (ct > 0.95) ct = 0.95;
+                if (rs > 3.98) rs = 3.98;
+                double in = b->f[i] - (rs * b1);
+                b0 += ct * (in - b0); b1 += ct * (b0 - b1);
+                if (each) { b0 = safe_step(b0); b1 = safe_step(b1); }
+                x->f[i] = b1;
+            }
             b0 = safe_val(b0); b1 = safe_val(b1);
-            x->f[i] = b1;
         }
+        if (!each) safe_run(x->f, b->n);
         k_free(ctx, a); k_free(ctx, b); return x;
     }
 
     if (c == 'g') {
         GAS_CHECK(ctx, b->n);
-        x = k_new(ctx, b->n);
-        double s0 = 0.0, s1 = 0.0;
+        x = k_reuse(ctx, b);
         double static_f = a->f[0];
         double q_val    = (a->n >= 2) ? a->f[1] : 0.5;
         double damp     = 1.0 / (q_val < 0.01 ? 0.01 : q_val);
-        for (int i = 0; i < b->n; i++) {
-            double f_hz    = (a->n == b->n) ? a->f[i] : static_f;
-            double f_coeff = 2.0 * sin(M_PI * f_hz / 44100.0);
-            if (f_coeff > 1.99) f_coeff = 1.99;
-            double hp = b->f[i] - s0 - damp * s1;
-            s1 += f_coeff * hp; s0 += f_coeff * s1;
-            s0 = safe_val(s0); s1 = safe_val(s1);
-            x->f[i] = s1;
+        if (a->n == b->n)
+            svf_swept(ctx, x->f, b->f, a->f, b->n, damp, clamp_span(ctx, b->n));
+        else {
+            int lanes = (a->n == 3 && b->n > 3 && a->f[2] >= 1) ? (int)fmin(a->f[2], b->n) : 1;
+            svf_lanes(x->f, b->f, b->n, lanes, svf_coeff(static_f), damp, clamp_span(ctx, b->n));
         }
         k_free(ctx, a); k_free(ctx, b); return x;
     }
 
     if (c == 'y') {
+        if (a->n >= 4 && a->n % 2 == 0) {
+            int taps = a->n / 2 < KS_MAX_TAPS ? a->n / 2 : KS_MAX_TAPS;
+            GAS_CHECK(ctx, (long long)b->n * taps);
+            x = k_reuse(ctx, b);
+            delay_taps(x->f, b->f, b->n, a->f, taps, clamp_span(ctx, b->n));
+            k_free(ctx, a); k_free(ctx, b); return x;
+        }
         int dd   = (int)a->f[0];
         double g = (a->n > 1) ? a->f[1] : 0.4;
         GAS_CHECK(ctx, b->n);
-        x = k_new(ctx, b->n);
-        for (int i = 0; i < b->n; i++) {
-            double delayed = (i >= dd) ? x->f[i-dd] : 0;
-            x->f[i] = safe_val(b->f[i] + (g * delayed));
-        }
+        x = k_reuse(ctx, b);
+        delay1(x->f, b->f, b->n, dd < 1 ? 1 : dd, g, clamp_span(ctx, b->n));
         k_free(ctx, a); k_free(ctx, b); return x;
     }
 
@@ -643,8 +2459,8 @@ K dy(ks_ctx *ctx, char c, K a, K b) {
         int n = a->n + b->n;
         GAS_CHECK(ctx, n);
         x = k_new(ctx, n);
-        memcpy(x->f, a->f, a->n * sizeof(double));
-        memcpy(x->f + a->n, b->f, b->n * sizeof(double));
+        memcpy(x->f, a->f, a->n * sizeof(ks_real));
+        memcpy(x->f + a->n, b->f, b->n * sizeof(ks_real));
         k_free(ctx, a); k_free(ctx, b); return x;
     }
 
@@ -652,195 +2468,1086 @@ K dy(ks_ctx *ctx, char c, K a, K b) {
     {
         int mn = a->n > b->n ? a->n : b->n;
         GAS_CHECK(ctx, mn);
-        x = k_new(ctx, mn);
-        for (int i = 0; i < mn; i++) {
-            double va = a->f[i % a->n], vb = b->f[i % b->n];
-            switch (c) {
-                case '+': x->f[i] = va + vb; break;
-                case '*': x->f[i] = va * vb; break;
-                case '-': x->f[i] = va - vb; break;
-                case '%': x->f[i] = (vb == 0) ? 0 : va / vb; break;
-                case '^': x->f[i] = safe_val(pow(fabs(va), vb)); break;
-                case '&': x->f[i] = va < vb ? va : vb; break;
-                case '|': x->f[i] = va > vb ? va : vb; break;
-                case '<': x->f[i] = va < vb ? 1.0 : 0.0; break;
-                case '>': x->f[i] = va > vb ? 1.0 : 0.0; break;
-                case '=': x->f[i] = va == vb ? 1.0 : 0.0; break;
-                default:  x->f[i] = 0; break;
-            }
+        if (a->n == mn && a != b && k_unique(ctx, a)) x = k_reuse(ctx, a);
+        else if (b->n == mn && a != b) x = k_reuse(ctx, b);
+        else x = k_new(ctx, mn);
+        if (a->n == 0 || b->n == 0) {
+            for (int i = 0; i < mn; i++)
+                x->f[i] = dy1(c, a->f[i % a->n], b->f[i % b->n]);
+        } else if (a->n == 1 || b->n == 1 || a->n == b->n) {
+            dy_par(ctx, c, x->f, a->f, a->n > 1, b->f, b->n > 1, mn);
+        } else if (a->n == mn) {
+            /* shorter side cycles: whole periods of b at a time */
+            for (int i = 0; i < mn; i += b->n)
+                dy_kernel(c, x->f + i, a->f + i, 1, b->f, 1, mn - i < b->n ? mn - i : b->n);
+        } else {
+            for (int i = 0; i < mn; i += a->n)
+                dy_kernel(c, x->f + i, a->f, 1, b->f + i, 1, mn - i < a->n ? mn - i : a->n);
         }
         k_free(ctx, a); k_free(ctx, b); return x;
     }
 }
 
-/* --- Parser & Evaluator ---
- * * Evaluates right-to-left.
- * The parser advances a char pointer (`char **s`) in place.
- * * Call Graph:
- * e()    -> parses statement sequences separated by ';'
- * expr() -> handles dyadic operators (A + B) and function calls (F arg)
- * atom() -> parses literals, variables (A-Z), monads, and (...) groups
+/* --- Fusion ---
+ * Element-wise chains like `(s P)*e(T*(0-6.9%N))` would otherwise
+ * materialise one full vector per verb. The evaluator instead builds
+ * a small tree of pending ops (a "fused" K, n == KS_FUSED) and only
+ * computes it when something needs the values, one block of
+ * KS_FUSE_BLOCK samples at a time through every op in the chain.
+ * * Only pure per-element verbs fuse, and only when every input is a
+ * scalar or the full result length, so no cycling is needed. Operands
+ * are still evaluated in source order and gas is charged when each op
+ * is recorded, exactly when mo/dy would have charged it. Anything else
+ * (scans, r, reversal, mixed lengths, function calls, assignment)
+ * forces its inputs first and runs the ordinary verb.
+ * * Leaves can be generators as well as vectors: `!N`, `~N` and `N#F`
+ * are pure functions of the index, so they are never filled unless
+ * they reach a consumer on their own. `+\(N#F)` has a closed form
+ * (whole periods times the period sum, plus a prefix of one period)
+ * and becomes a generator too.
  */
 
-K atom(ks_ctx *ctx, char **s);
-K expr(ks_ctx *ctx, char **s);
+#define KS_FUSE_BLOCK 256
+#define KS_FUSE_MO    "schtaqle_pxdn"
+#define KS_FUSE_DY    "+*-%^&|<>="
+
+enum { FZ_MO, FZ_DY, FZ_IOTA, FZ_RAMP, FZ_TILE, FZ_SUMTILE };
 
-K expr(ks_ctx *ctx, char **s) {
-    K x = atom(ctx, s);
-    while (**s == ' ') (*s)++;
+typedef struct {
+    int n;               /* result length (always > 1) */
+    char kind, op;
+    ks_accuracy acc;     /* FZ_MO: ctx->accuracy when recorded */
+    K a, b;              /* operands, length 1 or n; tile/prefix source */
+    double s;            /* FZ_SUMTILE: sum of one period */
+    ks_real *buf;        /* block scratch, set when forced */
+} ks_fuse;
 
-    if (k_is_func(x) && **s && **s != '\n' && **s != ')' && **s != ';' && **s != '}' && **s != '/') {
-        char peek = **s;
-        int is_operator = strchr("+-*%^&|<>=,#osfzt haqle rpciw dvmbu jkn g", peek) != NULL;
-        if (!is_operator) {
-            K arg = expr(ctx, s);
-            K call_args[1] = {arg};
-            K result = k_call(ctx, x, call_args, 1);
-            k_free(ctx, x);
-            return result;
+static int k_is_fused(K x) {
+    return x && x->n == KS_FUSED;
+}
+
+/* A fused K carries a pointer to its node in f[0]. */
+static ks_fuse *fuse_of(K x) {
+    ks_fuse *z;
+    memcpy(&z, x->f, sizeof z);
+    return z;
+}
+
+static int k_len(K x) {
+    return k_is_fused(x) ? fuse_of(x)->n : x->n;
+}
+
+static K fuse_node(ks_ctx *ctx, char kind, char op, K a, K b, int n) {
+    GAS_CHECK(ctx, n);
+    ks_fuse *z = arena_alloc(ctx, sizeof(ks_fuse));
+    K x = k_new(ctx, KS_FUSED_SLOTS);
+    x->n = KS_FUSED;
+    memcpy(x->f, &z, sizeof z);
+    z->n = n; z->kind = kind; z->op = op; z->acc = ctx->accuracy;
+    z->a = a; z->b = b; z->s = 0; z->buf = NULL;
+    return x;
+}
+
+/* One block of scratch per task for every node. */
+static void fuse_alloc(ks_ctx *ctx, K x, int tasks) {
+    if (!k_is_fused(x)) return;
+    ks_fuse *z = fuse_of(x);
+    z->buf = arena_alloc(ctx, (size_t)tasks * KS_FUSE_BLOCK * sizeof(ks_real));
+    if (z->kind == FZ_MO || z->kind == FZ_DY) fuse_alloc(ctx, z->a, tasks);
+    if (z->kind == FZ_DY) fuse_alloc(ctx, z->b, tasks);
+}
+
+/* Values [i0, i0+cnt) of x, in task t's scratch; *inc is 0 for a
+   scalar operand. */
+static const ks_real *fuse_block(K x, int i0, int cnt, int *inc, int t) {
+    if (!k_is_fused(x)) {
+        if (x->n == 1) { *inc = 0; return x->f; }
+        *inc = 1; return x->f + i0;
+    }
+    ks_fuse *z = fuse_of(x);
+    ks_real *o = z->buf + (size_t)t * KS_FUSE_BLOCK;
+    int ia, ib;
+    const ks_real *a, *b;
+    *inc = 1;
+    switch (z->kind) {
+    case FZ_MO:
+        a = fuse_block(z->a, i0, cnt, &ia, t);
+        mo_kernel(z->op, z->acc, o, a, ia, cnt);
+        break;
+    case FZ_DY:
+        a = fuse_block(z->a, i0, cnt, &ia, t);
+        b = fuse_block(z->b, i0, cnt, &ib, t);
+        dy_kernel(z->op, o, a, ia, b, ib, cnt);
+        break;
+    case FZ_IOTA:
+        for (int i = 0; i < cnt; i++) o[i] = (double)(i0 + i);
+        break;
+    case FZ_RAMP: {
+        double twopi = 2.0 * M_PI;
+        for (int i = 0; i < cnt; i++) o[i] = twopi * (double)(i0 + i) / (double)z->n;
+        break;
+    }
+    case FZ_TILE: {
+        int m = z->a->n, r = i0 % m;
+        for (int i = 0; i < cnt; i++) { o[i] = z->a->f[r]; if (++r == m) r = 0; }
+        break;
+    }
+    case FZ_SUMTILE: {
+        int m = z->a->n, q = i0 / m, r = i0 % m;
+        for (int i = 0; i < cnt; i++) {
+            o[i] = (double)q * z->s + z->a->f[r];
+            if (++r == m) { r = 0; q++; }
         }
+        break;
+    }
     }
+    return o;
+}
+
+/* A full-length operand nobody else holds can take the result: each
+   block is computed into scratch before it is stored back. */
+static K fuse_leaf(ks_ctx *ctx, K x, int n) {
+    if (!k_is_fused(x)) return (x->n == n && k_unique(ctx, x)) ? x : NULL;
+    ks_fuse *z = fuse_of(x);
+    K r = NULL;
+    if (z->kind == FZ_MO || z->kind == FZ_DY) r = fuse_leaf(ctx, z->a, n);
+    if (!r && z->kind == FZ_DY) r = fuse_leaf(ctx, z->b, n);
+    return r;
+}
 
-    if (!**s || **s == '\n' || **s == ')' || **s == ';' || **s == '}' || **s == '/') return x;
-    char op = *(*s)++;
-    return dy(ctx, op, x, expr(ctx, s));
+/* Drop a fused tree's references to its operands, except `keep`. */
+static void fuse_release(ks_ctx *ctx, K x, K keep) {
+    if (!k_is_fused(x)) { if (x != keep) k_free(ctx, x); return; }
+    ks_fuse *z = fuse_of(x);
+    if (z->kind == FZ_DY) fuse_release(ctx, z->b, keep);
+    if (z->a) fuse_release(ctx, z->a, keep);
+    k_free(ctx, x);
 }
 
-K atom(ks_ctx *ctx, char **s) {
-    while (**s == ' ') (*s)++;
-    if (**s == '/') {
-        while (**s && **s != '\n') (*s)++;
-        if (**s == '\n') (*s)++;
-        return atom(ctx, s);
+typedef struct { K x; ks_real *o; } ks_force_job;
+
+static void force_chunk(void *arg, int t, int i0, int i1) {
+    ks_force_job *j = arg;
+    int inc;
+    for (; i0 < i1; i0 += KS_FUSE_BLOCK) {
+        int cnt = i1 - i0 < KS_FUSE_BLOCK ? i1 - i0 : KS_FUSE_BLOCK;
+        memcpy(j->o + i0, fuse_block(j->x, i0, cnt, &inc, t), cnt * sizeof(ks_real));
     }
-    if (!**s || **s == '\n' || **s == ')' || **s == ';') return NULL;
+}
 
-    if (**s == '(') {
-        (*s)++; K x = e(ctx, s);
-        if (**s == ')') (*s)++;
-        return x;
+/* Materialise a fused value; ordinary values pass through. Long ones
+   are computed in pieces side by side, each task with its own block
+   scratch in every node. */
+static K force(ks_ctx *ctx, K x) {
+    if (!k_is_fused(x)) return x;
+    int n = fuse_of(x)->n;
+    K r = fuse_leaf(ctx, x, n);
+    if (!r) r = k_new(ctx, n);
+    char *scratch = ctx->arena_ptr;
+    fuse_alloc(ctx, x, par_tasks(ctx, n));
+    ks_force_job j = { x, r->f };
+    par_chunks(ctx, n, force_chunk, &j);
+    ctx->arena_ptr = scratch;
+    fuse_release(ctx, x, r);
+    return r;
+}
+
+/* +\ over a tile: prefix sums of one period, then whole periods. */
+static K fuse_sumtile(ks_ctx *ctx, K tile) {
+    ks_fuse *t = fuse_of(tile);
+    int m = t->a->n;
+    K x = fuse_node(ctx, FZ_SUMTILE, '+', k_new(ctx, m), NULL, t->n);
+    ks_fuse *z = fuse_of(x);
+    double acc = 0.0;
+    for (int i = 0; i < m; i++) { acc += t->a->f[i]; z->a->f[i] = acc; }
+    z->s = acc;
+    fuse_release(ctx, tile, NULL);
+    return x;
+}
+
+/* Evaluator entry points for verbs: record fusable ops, force the rest. */
+static K ev_mo(ks_ctx *ctx, char c, int is_scan, K b) {
+    if (is_scan) {
+        if (c == '+' && k_is_fused(b) && fuse_of(b)->kind == FZ_TILE)
+            return fuse_sumtile(ctx, b);
+        return scan(ctx, c, force(ctx, b));
     }
+    if (b && c && strchr(KS_FUSE_MO, c) && k_len(b) > 1)
+        return fuse_node(ctx, FZ_MO, c, b, NULL, k_len(b));
+    b = force(ctx, b);
+    if ((c == '!' || c == '~') && b && b->n > 0) {
+        int n = (int)b->f[0];
+        if (n > 1 && n <= 1000000) {
+            k_free(ctx, b);
+            return fuse_node(ctx, c == '!' ? FZ_IOTA : FZ_RAMP, c, NULL, NULL, n);
+        }
+    }
+    return mo(ctx, c, b);
+}
 
-    if (**s == '{') {
-        (*s)++;
-        char *start = *s;
-        int depth = 1;
-        while (**s && depth > 0) {
-            if (**s == '{') depth++;
-            else if (**s == '}') depth--;
-            (*s)++;
+static K ev_dy(ks_ctx *ctx, char c, K a, K b) {
+    if (a && b && c && strchr(KS_FUSE_DY, c)) {
+        int na = k_len(a), nb = k_len(b);
+        int n = na > nb ? na : nb;
+        if (n > 1 && (na == n || na == 1) && (nb == n || nb == 1))
+            return fuse_node(ctx, FZ_DY, c, a, b, n);
+    }
+    a = force(ctx, a);
+    b = force(ctx, b);
+    if (c == '#' && a && b && a->n > 0 && b->n > 0) {
+        int n = (int)a->f[0];
+        if (n > 1 && n <= 1000000) {
+            k_free(ctx, a);
+            return fuse_node(ctx, FZ_TILE, c, b, NULL, n);
         }
-        if (depth == 0) {
-            int len = (*s - 1) - start;
-            char *body = malloc(len + 1);
-            memcpy(body, start, len);
-            body[len] = '\0';
-            K func = k_func(ctx, body);
-            free(body);
-            return func;
+    }
+    return dy(ctx, c, a, b);
+}
+
+/* --- Compiler & Evaluator ---
+ * * Evaluates right-to-left.
+ * Source is compiled into nodes memoised by source offset, then run.
+ * The grammar is the same one the old char-walking parser accepted;
+ * a few of its decisions depend on values (is `N` a scalar, so `1 N`
+ * strands? is `F` a function, so `F (x)` applies?). Those points
+ * keep both readings and pick one at run time, and any production
+ * reached only through such a choice is compiled the first time it
+ * is needed. After the first run a program never touches its source.
+ * * Productions (each keyed by the offset it starts at):
+ * seq  -> statement sequences separated by ';'       (was e())
+ * expr -> an atom followed by its tail                (was expr()/atom())
+ * tail -> end, dyadic operator, or function call      (after an atom)
+ * next -> what follows an expr inside a seq           (';' or end)
+ */
+
+#define KS_OPS "+-*%^&|<>=,#osfzt haqle rpciw dvmbu jkn g"
+
+enum {
+    N_NIL, N_PAREN, N_FUNC, N_NUMS, N_VARS, N_SET, N_ARG, N_MO,  /* expr */
+    T_END, T_DY, T_DYN,                                           /* tail */
+    S_END, S_NEXT, S_EMPTY                                        /* next */
+};
+
+typedef struct { int slot; char v; int cont; } ks_cand;
+
+typedef struct ks_node {
+    char kind;
+    char c;              /* verb, operator or assigned letter */
+    char scan;           /* N_MO: adverb `\` */
+    int  pos;            /* inner production / static end offset */
+    int  end;            /* atom end offset for static atoms */
+    int  n, nc;          /* values/letters and candidate counts */
+    ks_real *vals;       /* N_NUMS literal values */
+    char *text;          /* N_FUNC body, N_VARS letters */
+    int  *after;         /* N_VARS: offset after each letter */
+    ks_cand *cand;       /* N_NUMS: scalar variables that may strand */
+    char fold, memo;     /* expr: 0 not yet decided, 1 yes, -1 no */
+    int  fn, fend;       /* folded value length and production end */
+    ks_real *fv;         /* folded value */
+    unsigned hash, reads; /* memo: span hash and variables read */
+    int  span;           /* memo: span length */
+} ks_node;
+
+/* Compile memory: program-owned malloc chunks, or the eval arena for
+   one-shot compiles (ks_eval, function bodies) whose nodes die with it. */
+typedef struct ks_chunk { struct ks_chunk *next; } ks_chunk;
+
+typedef struct {
+    ks_ctx   *arena;     /* non-NULL: allocate from this eval's arena */
+    ks_chunk *chunks;
+    char     *ptr, *end;
+} ks_cmem;
+
+typedef struct {
+    const char *src;     /* NUL-terminated statement text */
+    int len;
+    ks_node **xs, **ts, **ss;  /* expr, tail, next memo tables */
+    ks_cmem *mem;
+    ks_cmem nodes;       /* program statements: productions compiled on use */
+    const unsigned *dups; /* sorted hashes of spans seen more than once */
+    int ndups;
+    char wvar;           /* rerunnable `X: expr` statement: X, else 0 */
+    char noise;          /* draws from the context's `r` stream */
+    unsigned reads;      /* variables the text reads */
+    unsigned writes;     /* variables it assigns */
+    long long work;      /* gas its last run used */
+} ks_stmt;
+
+struct ks_program {
+    int n;
+    ks_stmt *stmts;
+    ks_cmem mem;
+    unsigned stable;     /* vars a rerun may keep from the last run */
+    int funcs;           /* defines functions: statements run in order */
+};
+
+static void *c_alloc(ks_ctx *ctx, ks_cmem *m, size_t sz) {
+    void *p;
+    sz = KS_ALIGN_UP(sz);
+    if (m->arena) {
+        p = arena_alloc(m->arena, sz);
+    } else {
+        if (m->ptr + sz > m->end) {
+            size_t cap = m->chunks ? 16384 : 2048;
+            if (cap < sz) cap = sz;
+            ks_chunk *c = malloc(sizeof(ks_chunk) + KS_ALIGN + cap);
+            if (!c) {
+                if (ctx) { ctx->last_status = KS_ERR_OOM; longjmp(ctx->recover, 1); }
+                return NULL;
+            }
+            c->next = m->chunks; m->chunks = c;
+            m->ptr = (char *)c + KS_ALIGN_UP(sizeof(ks_chunk));
+            m->end = m->ptr + cap;
         }
-        return NULL;
+        p = m->ptr; m->ptr += sz;
     }
+    memset(p, 0, sz);
+    return p;
+}
+
+static void c_release(ks_cmem *m) {
+    while (m->chunks) { ks_chunk *c = m->chunks; m->chunks = c->next; free(c); }
+    m->ptr = m->end = NULL;
+}
 
-    char c = **s;
+static int is_end(char c) {
+    return !c || c == '\n' || c == ')' || c == ';' || c == '}' || c == '/';
+}
 
-    if ((c >= '0' && c <= '9') || (c == '.' && (*s)[1] >= '0') ||
-        (c == '-' && ((*s)[1] >= '0' || (*s)[1] == '.'))) {
-        double buf[1024]; int n = 0;
-        char *ptr = *s;
+static ks_node *c_node(ks_ctx *ctx, ks_stmt *st, char kind) {
+    ks_node *x = c_alloc(ctx, st->mem, sizeof(ks_node));
+    x->kind = kind;
+    return x;
+}
+
+/* expr: one atom and where it stops. Mirrors the grammar atom() had. */
+static ks_node *c_expr(ks_ctx *ctx, ks_stmt *st, int at) {
+    if (st->xs[at]) return st->xs[at];
+    const char *s = st->src + at;
+    ks_node *x;
+
+    for (;;) {
+        while (*s == ' ') s++;
+        if (*s != '/') break;
+        while (*s && *s != '\n') s++;
+        if (*s == '\n') s++;
+    }
+
+    if (!*s || *s == '\n' || *s == ')' || *s == ';') {
+        x = c_node(ctx, st, N_NIL);
+        x->end = (int)(s - st->src);
+    } else if (*s == '(') {
+        x = c_node(ctx, st, N_PAREN);
+        x->pos = (int)(s + 1 - st->src);
+    } else if (*s == '{') {
+        const char *start = ++s;
+        int depth = 1;
+        while (*s && depth > 0) {
+            if (*s == '{') depth++;
+            else if (*s == '}') depth--;
+            s++;
+        }
+        if (depth == 0) {
+            int len = (int)((s - 1) - start);
+            x = c_node(ctx, st, N_FUNC);
+            x->text = c_alloc(ctx, st->mem, len + 1);
+            memcpy(x->text, start, len);
+        } else {
+            x = c_node(ctx, st, N_NIL);
+        }
+        x->end = (int)(s - st->src);
+    } else if ((*s >= '0' && *s <= '9') || (*s == '.' && s[1] >= '0') ||
+               (*s == '-' && (s[1] >= '0' || s[1] == '.'))) {
+        /* Numeric strand. A spaced scalar variable continues it, which
+           is only known at run time: keep a candidate per letter. */
+        double buf[1024]; ks_cand cand[1024]; int n = 0, nc = 0;
+        const char *ptr = s;
         while (n < 1024) {
-            buf[n++] = strtod(ptr, &ptr);
-            char *after = ptr;
-            char *peek  = ptr;
+            char *endp;
+            buf[n++] = strtod(ptr, &endp);
+            ptr = endp;
+            const char *peek = ptr;
             while (*peek == ' ') peek++;
-            int had_space = (peek != after);
+            int had_space = (peek != ptr);
             if (*peek >= '0' && *peek <= '9') { ptr = peek; continue; }
             if (*peek == '-' && peek[1] >= '0' && had_space) { ptr = peek; continue; }
             if (had_space && *peek >= 'A' && *peek <= 'Z' && peek[1] != ':') {
-                K v = ctx->vars[*peek - 'A'];
-                if (v && v->n == 1) { buf[n++] = v->f[0]; ptr = peek + 1; continue; }
+                cand[nc].slot = n; cand[nc].v = *peek;
+                cand[nc].cont = (int)(peek + 1 - st->src);
+                nc++; buf[n++] = 0; ptr = peek + 1;
+                continue;
             }
             break;
         }
-        *s = ptr;
-        K x = k_new(ctx, n); memcpy(x->f, buf, n * sizeof(double));
-        return x;
+        x = c_node(ctx, st, N_NUMS);
+        x->n = n; x->nc = nc;
+        x->vals = c_alloc(ctx, st->mem, n * sizeof(ks_real));
+        for (int j = 0; j < n; j++) x->vals[j] = (ks_real)buf[j];
+        if (nc) {
+            x->cand = c_alloc(ctx, st->mem, nc * sizeof(ks_cand));
+            memcpy(x->cand, cand, nc * sizeof(ks_cand));
+        }
+        x->end = (int)(ptr - st->src);
+    } else {
+        char c = *s++;
+        if (*s == ':') {
+            x = c_node(ctx, st, N_SET);
+            x->c = c;
+            x->pos = (int)(s + 1 - st->src);
+        } else if (c >= 'A' && c <= 'Z') {
+            /* Variable strand: `A B C` joins while every letter is scalar. */
+            char letters[1024]; int after[1024]; int n = 0;
+            letters[n] = c; after[n++] = (int)(s - st->src);
+            const char *ptr = s;
+            while (n < 1024) {
+                const char *peek = ptr;
+                while (*peek == ' ') peek++;
+                if (peek == ptr) break;
+                if (*peek < 'A' || *peek > 'Z') break;
+                if (peek[1] == ':') break;
+                letters[n] = *peek; after[n++] = (int)(peek + 1 - st->src);
+                ptr = peek + 1;
+            }
+            x = c_node(ctx, st, N_VARS);
+            x->n = n;
+            x->text = c_alloc(ctx, st->mem, n);
+            memcpy(x->text, letters, n);
+            x->after = c_alloc(ctx, st->mem, n * sizeof(int));
+            memcpy(x->after, after, n * sizeof(int));
+            x->end = (int)(ptr - st->src);
+        } else if (c == 'x' || c == 'y') {
+            x = c_node(ctx, st, N_ARG);
+            x->c = c;
+            x->end = (int)(s - st->src);
+        } else {
+            x = c_node(ctx, st, N_MO);
+            x->c = c;
+            while (*s == ' ') s++;
+            if (*s == '\\') { x->scan = 1; s++; }
+            x->pos = (int)(s - st->src);
+        }
     }
+    st->xs[at] = x;
+    return x;
+}
 
-    (*s)++;
-
-    if (**s == ':') {
-        (*s)++; K x = expr(ctx, s);
-        if (c >= 'A' && c <= 'Z' && x) {
-            int i = c - 'A';
-            /* Copy x (arena) into a persistent malloc'd object for vars[]. */
-            K perm;
-            if (k_is_func(x)) {
-                int len = strlen((char*)x->f) + 1;
-                int ndoubles = (len + sizeof(double) - 1) / sizeof(double);
-                perm = k_new_perm(ctx, ndoubles);
-                if (!perm) longjmp(ctx->recover, 1);
-                perm->n = -1;
-                memcpy(perm->f, x->f, len);
-            } else {
-                perm = k_new_perm(ctx, x->n);
-                if (!perm) longjmp(ctx->recover, 1);
-                memcpy(perm->f, x->f, x->n * sizeof(double));
-            }
-            if (ctx->vars[i]) k_free(ctx, ctx->vars[i]);
-            ctx->vars[i] = perm;
+/* tail: what follows an atom that stopped at `at`. */
+static ks_node *c_tail(ks_ctx *ctx, ks_stmt *st, int at) {
+    if (st->ts[at]) return st->ts[at];
+    const char *s = st->src + at;
+    while (*s == ' ') s++;
+    ks_node *t;
+    if (is_end(*s)) {
+        t = c_node(ctx, st, T_END);
+    } else {
+        /* Operators always apply dyadically; anything else applies the
+           left value as a function when it turns out to be one. */
+        t = c_node(ctx, st, strchr(KS_OPS, *s) ? T_DY : T_DYN);
+        t->c = *s;
+    }
+    t->pos = (int)(s - st->src);
+    st->ts[at] = t;
+    return t;
+}
+
+/* next: what follows an expr that stopped at `at` inside a seq. */
+static ks_node *c_next(ks_ctx *ctx, ks_stmt *st, int at) {
+    if (st->ss[at]) return st->ss[at];
+    const char *s = st->src + at;
+    ks_node *q;
+    while (*s == ' ') s++;
+    if (*s == ';') {
+        s++;
+        while (*s == ' ') s++;
+        if (!*s || *s == '\n' || *s == ')' || *s == '}') q = c_node(ctx, st, S_EMPTY);
+        else q = c_node(ctx, st, S_NEXT);
+    } else {
+        q = c_node(ctx, st, S_END);
+    }
+    q->pos = (int)(s - st->src);
+    st->ss[at] = q;
+    return q;
+}
+
+/* --- Constant Folding ---
+ * A production made only of literals, pure per-element verbs and
+ * arithmetic (`6.28318%44100`, `s 0.5`, `2*(1 2 3)`) has the same value
+ * every run, so it is computed once when first compiled, with the same
+ * kernels the verbs use, and stored in the node. Results longer than
+ * KS_FOLD_MAX are left to run time. */
+
+#define KS_FOLD_MAX 256
+
+static int c_fold(ks_ctx *ctx, ks_stmt *st, int at) {
+    ks_node *x = c_expr(ctx, st, at), *y;
+    if (x->fold) return x->fold;
+    x->fold = -1;
+    ks_real *v;
+    int n, a;
+    switch (x->kind) {
+    case N_NUMS:
+        if (x->nc) return -1;
+        v = x->vals; n = x->n; a = x->end;
+        break;
+    case N_MO:
+        if (x->scan || !x->c || !strchr(KS_FUSE_MO, x->c)) return -1;
+        if (c_fold(ctx, st, x->pos) != 1) return -1;
+        y = c_expr(ctx, st, x->pos);
+        n = y->fn; a = y->fend;
+        v = c_alloc(ctx, st->mem, (n ? n : 1) * sizeof(ks_real));
+        for (int i = 0; i < n; i++) v[i] = mo1(x->c, y->fv[i]);
+        break;
+    case N_PAREN: {
+        if (c_fold(ctx, st, x->pos) != 1) return -1;
+        y = c_expr(ctx, st, x->pos);
+        ks_node *q = c_next(ctx, st, y->fend);
+        if (q->kind != S_END) return -1;
+        v = y->fv; n = y->fn; a = q->pos;
+        if (st->src[a] == ')') a++;
+        break;
+    }
+    default:
+        return -1;
+    }
+    ks_node *t = c_tail(ctx, st, a);
+    if (t->kind == T_END) {
+        a = t->pos;
+    } else if (t->kind == T_DY && strchr(KS_FUSE_DY, t->c)) {
+        if (c_fold(ctx, st, t->pos + 1) != 1) return -1;
+        y = c_expr(ctx, st, t->pos + 1);
+        if (n == 0 || y->fn == 0) return -1;
+        int m = n > y->fn ? n : y->fn;
+        if (m > KS_FOLD_MAX) return -1;
+        ks_real *w = c_alloc(ctx, st->mem, m * sizeof(ks_real));
+        for (int i = 0; i < m; i++) w[i] = dy1(t->c, v[i % n], y->fv[i % y->fn]);
+        v = w; n = m; a = y->fend;
+    } else {
+        return -1;
+    }
+    if (n > KS_FOLD_MAX) return -1;
+    x->fv = v; x->fn = n; x->fend = a;
+    x->fold = 1;
+    return 1;
+}
+
+/* --- Common Subexpressions ---
+ * Because evaluation is right to left, the expression starting at any
+ * offset runs to the first ')', ';', newline, '}' or comment at its own
+ * depth, so its text is known before it runs. When the same pure text
+ * (no assignment, r, x/y or function literal) occurs twice in a program
+ * or statement, its value is remembered per context together with the
+ * generation of every variable it reads, and reused while those
+ * variables are unchanged. `t` reads N implicitly, so it counts. */
+
+#define KS_MEMO_SPAN  256
+#define KS_MEMO_SLOTS 32
+
+static unsigned c_hash(const char *s, int n) {
+    unsigned h = 2166136261u;
+    while (n-- > 0) h = (h ^ (unsigned char)*s++) * 16777619u;
+    return h;
+}
+
+/* Length of the pure span at `at`, or 0; *reads gets its variables. */
+static int c_span(const char *src, int at, unsigned *reads) {
+    int depth = 0, work = 0, i;
+    unsigned rd = 0;
+    for (i = at; ; i++) {
+        char ch = src[i];
+        if (depth == 0 && is_end(ch)) break;
+        if (!ch || i - at >= KS_MEMO_SPAN) return 0;
+        if (ch == '(') depth++;
+        else if (ch == ')') depth--;
+        else if (ch == ':' || ch == 'r' || ch == 'x' || ch == 'y' ||
+                 ch == '{' || ch == '}') return 0;
+        else if (ch >= 'A' && ch <= 'Z') rd |= 1u << (ch - 'A');
+        else if (ch == 't') rd |= 1u << ('N' - 'A');
+        if (!(ch == ' ' || ch == '.' || ch == '(' || ch == ')' ||
+              (ch >= '0' && ch <= '9') || (ch >= 'A' && ch <= 'Z'))) work = 1;
+    }
+    if (!work) return 0;
+    *reads = rd;
+    return i - at;
+}
+
+static int cmp_hash(const void *a, const void *b) {
+    unsigned x = *(const unsigned *)a, y = *(const unsigned *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Collect the span hashes that occur more than once across statements
+   and share them between those statements. Best effort: no memory, no
+   sharing. */
+static void c_dups(ks_ctx *ctx, ks_cmem *mem, ks_stmt *sts, int nst) {
+    int total = 0, k = 0, nd = 0;
+    for (int s = 0; s < nst; s++) total += sts[s].len;
+    if (!total) return;
+    unsigned *h = malloc(total * sizeof(unsigned));
+    if (!h) return;
+    for (int s = 0; s < nst; s++) {
+        unsigned rd;
+        for (int p = 0; p < sts[s].len; p++) {
+            int len = c_span(sts[s].src, p, &rd);
+            if (len) h[k++] = c_hash(sts[s].src + p, len);
         }
+    }
+    qsort(h, k, sizeof(unsigned), cmp_hash);
+    for (int i = 1; i < k; i++)
+        if (h[i] == h[i - 1] && (nd == 0 || h[nd - 1] != h[i])) h[nd++] = h[i];
+    unsigned *d = nd ? c_alloc(ctx, mem, nd * sizeof(unsigned)) : NULL;
+    if (d) {
+        memcpy(d, h, nd * sizeof(unsigned));
+        for (int s = 0; s < nst; s++) { sts[s].dups = d; sts[s].ndups = nd; }
+    }
+    free(h);
+}
+
+/* Decide once per node whether its production is worth remembering. */
+static int c_memo(ks_stmt *st, ks_node *n, int at) {
+    if (n->memo) return n->memo;
+    n->memo = -1;
+    if (!st->ndups || n->kind == N_SET || n->kind == N_NIL) return -1;
+    unsigned rd;
+    int len = c_span(st->src, at, &rd);
+    if (!len) return -1;
+    unsigned h = c_hash(st->src + at, len);
+    if (!bsearch(&h, st->dups, st->ndups, sizeof(unsigned), cmp_hash)) return -1;
+    n->hash = h; n->reads = rd; n->span = len;
+    n->memo = 1;
+    return 1;
+}
+
+/* A statement owns a copy of its text and one memo table per production.
+   With ctx == NULL (ks_compile) allocation failure returns -1. */
+static int stmt_init(ks_ctx *ctx, ks_stmt *st, ks_cmem *mem,
+                     const char *code, size_t len) {
+    char *src = c_alloc(ctx, mem, len + 1);
+    st->xs = c_alloc(ctx, mem, (len + 1) * sizeof(ks_node *));
+    st->ts = c_alloc(ctx, mem, (len + 1) * sizeof(ks_node *));
+    st->ss = c_alloc(ctx, mem, (len + 1) * sizeof(ks_node *));
+    if (!src || !st->xs || !st->ts || !st->ss) return -1;
+    memcpy(src, code, len);
+    st->src = src;
+    st->len = (int)len;
+    st->mem = mem;
+    st->dups = NULL;
+    st->ndups = 0;
+    return 0;
+}
+
+static K run_expr(ks_ctx *ctx, ks_stmt *st, int at, int *end);
+
+/* `a;b;c`: once a statement's value is dropped nothing it allocated is
+   reachable any more. Assignments live in vars[], outer operands sit
+   below the mark, and the nodes compiled for it (one-shot compiles put
+   them in the arena too) are never visited again since parsing only
+   moves forward. So the arena goes back to where the sequence began. */
+static K run_seq(ks_ctx *ctx, ks_stmt *st, int at, int *end) {
+    char *mark = ctx->arena_ptr;
+    K x = run_expr(ctx, st, at, end);
+    for (;;) {
+        ks_node *q = c_next(ctx, st, *end);
+        int kind = q->kind, pos = q->pos;
+        if (kind == S_END) { *end = pos; return x; }
+        if (x) fuse_release(ctx, x, NULL);
+        if (ctx->arena_ptr > mark) ctx->arena_ptr = mark;
+        if (kind == S_EMPTY) { *end = pos; return k_new(ctx, 0); }
+        x = run_expr(ctx, st, pos, end);
+    }
+}
+
+static K run_tail(ks_ctx *ctx, ks_stmt *st, int at, K x, int *end) {
+    ks_node *t = c_tail(ctx, st, at);
+    if (t->kind == T_END) { *end = t->pos; return x; }
+    if (t->kind == T_DYN && k_is_func(x)) {
+        K arg = force(ctx, run_expr(ctx, st, t->pos, end));
+        K call_args[1] = {arg};
+        K result = k_call(ctx, x, call_args, 1);
+        k_free(ctx, arg);
+        k_free(ctx, x);
+        return result;
+    }
+    return ev_dy(ctx, t->c, x, run_expr(ctx, st, t->pos + 1, end));
+}
+
+static void assign(ks_ctx *ctx, char c, K x) {
+    int i = c - 'A';
+    /* A buffer lent from another var is shared; anything else is copied
+       from the arena into a persistent malloc'd object for vars[]. */
+    K perm;
+    ks_loan *l = k_is_arena_owned(ctx, x) ? NULL : loan_find(ctx, x);
+    if (l) {
+        l->owners++;
+        x->r++;
+        perm = x;
+    } else if (k_is_func(x)) {
+        int len = strlen((char*)x->f) + 1;
+        int nslots = (len + sizeof(ks_real) - 1) / sizeof(ks_real);
+        perm = k_new_perm(ctx, nslots);
+        if (!perm) longjmp(ctx->recover, 1);
+        perm->n = -1;
+        memcpy(perm->f, x->f, len);
+    } else {
+        perm = k_new_perm(ctx, x->n);
+        if (!perm) longjmp(ctx->recover, 1);
+        memcpy(perm->f, x->f, x->n * sizeof(ks_real));
+    }
+    if (ctx->vars[i]) var_release(ctx, ctx->vars[i]);
+    ctx->vars[i] = perm;
+    ctx->gen[i]++;
+}
+
+static K run_node(ks_ctx *ctx, ks_stmt *st, ks_node *n, int *end) {
+    int a = n->end;
+    K x;
+
+    switch (n->kind) {
+    case N_NIL:
+        x = NULL;
+        break;
+    case N_PAREN:
+        x = run_seq(ctx, st, n->pos, &a);
+        if (st->src[a] == ')') a++;
+        break;
+    case N_FUNC:
+        x = k_func(ctx, n->text);
+        break;
+    case N_NUMS:
+        x = k_new(ctx, n->n);
+        memcpy(x->f, n->vals, n->n * sizeof(ks_real));
+        for (int j = 0; j < n->nc; j++) {
+            K v = ctx->vars[n->cand[j].v - 'A'];
+            if (v && v->n == 1) { x->f[n->cand[j].slot] = v->f[0]; continue; }
+            /* Not a scalar: the strand ends and the letter is a verb. */
+            x->n = n->cand[j].slot;
+            return ev_dy(ctx, n->cand[j].v, x, run_expr(ctx, st, n->cand[j].cont, end));
+        }
+        break;
+    case N_VARS: {
+        K first = ctx->vars[n->text[0] - 'A'];
+        if (!first || first->n != 1) {
+            x = first ? var_loan(ctx, first) : NULL;
+            a = n->after[0];
+            break;
+        }
+        x = k_new(ctx, n->n);
+        x->f[0] = first->f[0];
+        for (int j = 1; j < n->n; j++) {
+            K v = ctx->vars[n->text[j] - 'A'];
+            if (v && v->n == 1) { x->f[j] = v->f[0]; continue; }
+            x->n = j;
+            return ev_dy(ctx, n->text[j], x, run_expr(ctx, st, n->after[j], end));
+        }
+        break;
+    }
+    case N_SET:
+        x = force(ctx, run_expr(ctx, st, n->pos, &a));
+        if (n->c >= 'A' && n->c <= 'Z' && x) assign(ctx, n->c, x);
         /* Return x as-is (arena lifetime, caller frees via k_free no-op). */
-        return x;
+        break;
+    case N_ARG:
+        /* Each use takes a reference, so no verb mistakes x for a
+           temporary it may overwrite. */
+        x = ctx->args[n->c - 'x'];
+        if (x) x->r++;
+        else x = k_new(ctx, 0);
+        break;
+    default: {
+        K arg = run_expr(ctx, st, n->pos, &a);
+        x = ev_mo(ctx, n->c, n->scan, arg);
+        break;
+    }
     }
+    return run_tail(ctx, st, a, x, end);
+}
 
-    if (c >= 'A' && c <= 'Z') {
-        K first = k_get(ctx, c);
-        if (!first || first->n != 1) return first;
-        double buf[1024]; int n = 0;
-        buf[n++] = first->f[0];
-        k_free(ctx, first);
-        char *ptr = *s;
-        while (n < 1024) {
-            char *peek = ptr;
-            while (*peek == ' ') peek++;
-            if (peek == ptr) break;
-            if (*peek < 'A' || *peek > 'Z') break;
-            if (peek[1] == ':') break;
-            K v = ctx->vars[*peek - 'A'];
-            if (!v || v->n != 1) break;
-            buf[n++] = v->f[0];
-            ptr = peek + 1;
-        }
-        *s = ptr;
-        K x = k_new(ctx, n);
-        memcpy(x->f, buf, n * sizeof(double));
+typedef struct {
+    unsigned hash, reads;
+    int len;
+    char *text;
+    K val;               /* perm copy, NULL when the slot is empty */
+    unsigned gen[26];    /* variable generations when computed */
+} ks_memo_ent;
+
+struct ks_memo {
+    ks_memo_ent e[KS_MEMO_SLOTS];
+    size_t bytes;
+};
+
+static void memo_drop(struct ks_memo *m, ks_memo_ent *e) {
+    if (!e->val) return;
+    m->bytes -= e->val->n * sizeof(ks_real);
+    free(e->val); free(e->text);
+    e->val = NULL; e->text = NULL;
+}
+
+static int memo_live(ks_ctx *ctx, const ks_memo_ent *e) {
+    for (int i = 0; i < 26; i++)
+        if ((e->reads >> i & 1) &&
+            (e->gen[i] != ctx->gen[i] || k_is_func(ctx->vars[i]))) return 0;
+    return 1;
+}
+
+/* Forget entries whose inputs have changed; run between statements. */
+static void memo_sweep(ks_ctx *ctx) {
+    struct ks_memo *m = ctx->memo;
+    if (!m) return;
+    for (int i = 0; i < KS_MEMO_SLOTS; i++)
+        if (m->e[i].val && !memo_live(ctx, &m->e[i])) memo_drop(m, &m->e[i]);
+}
+
+static void memo_free(ks_ctx *ctx) {
+    if (!ctx->memo) return;
+    for (int i = 0; i < KS_MEMO_SLOTS; i++) memo_drop(ctx->memo, &ctx->memo->e[i]);
+    free(ctx->memo);
+    ctx->memo = NULL;
+}
+
+static K memo_get(ks_ctx *ctx, ks_stmt *st, ks_node *n, int at) {
+    if (!ctx->memo) return NULL;
+    ks_memo_ent *e = &ctx->memo->e[n->hash % KS_MEMO_SLOTS];
+    if (!e->val || e->hash != n->hash || e->len != n->span ||
+        memcmp(e->text, st->src + at, n->span) != 0 || !memo_live(ctx, e)) return NULL;
+    K x = k_new(ctx, e->val->n);
+    memcpy(x->f, e->val->f, e->val->n * sizeof(ks_real));
+    return x;
+}
+
+/* Best effort: any allocation failure just skips remembering. */
+static void memo_put(ks_ctx *ctx, ks_stmt *st, ks_node *n, int at, K x) {
+    if (!x || x->n < 0) return;
+    size_t sz = x->n * sizeof(ks_real);
+    if (!ctx->memo && !(ctx->memo = calloc(1, sizeof(struct ks_memo)))) return;
+    struct ks_memo *m = ctx->memo;
+    ks_memo_ent *e = &m->e[n->hash % KS_MEMO_SLOTS];
+    memo_drop(m, e);
+    if (m->bytes + sz > ctx->mem_limit) return;
+    K v = malloc(sizeof(*v) + sz);
+    char *text = malloc(n->span);
+    if (!v || !text) { free(v); free(text); return; }
+    v->r = 1; v->n = x->n;
+    memcpy(v->f, x->f, sz);
+    memcpy(text, st->src + at, n->span);
+    e->hash = n->hash; e->reads = n->reads; e->len = n->span;
+    e->text = text; e->val = v;
+    memcpy(e->gen, ctx->gen, sizeof e->gen);
+    m->bytes += sz;
+}
+
+static K run_expr(ks_ctx *ctx, ks_stmt *st, int at, int *end) {
+    ks_node *n = c_expr(ctx, st, at);
+    if (!n->fold) c_fold(ctx, st, at);
+    if (n->fold == 1) {
+        K x = k_new(ctx, n->fn);
+        memcpy(x->f, n->fv, n->fn * sizeof(ks_real));
+        *end = n->fend;
         return x;
     }
+    if (c_memo(st, n, at) != 1) return run_node(ctx, st, n, end);
+    K x = memo_get(ctx, st, n, at);
+    if (x) { *end = at + n->span; return x; }
+    x = force(ctx, run_node(ctx, st, n, end));
+    if (*end == at + n->span) memo_put(ctx, st, n, at, x);
+    return x;
+}
+
+/* Compile and run one e()-style sequence with nodes in the arena:
+   used for ks_eval, which is run once. */
+static K eval_once(ks_ctx *ctx, const char *code, size_t len) {
+    ks_cmem mem = { ctx, NULL, NULL, NULL };
+    ks_stmt st;
+    int end;
+    stmt_init(ctx, &st, &mem, code, len);
+    c_dups(ctx, &mem, &st, 1);
+    return run_seq(ctx, &st, 0, &end);
+}
 
-    if (c == 'x') return ctx->args[0] ? ctx->args[0] : k_new(ctx, 0);
-    if (c == 'y') return ctx->args[1] ? ctx->args[1] : k_new(ctx, 0);
+/* --- Function Bodies ---
+ * `{...}` values stay plain text in K (so they copy, print and store
+ * like before), but each distinct body is compiled once per context
+ * and kept here with its arity. Calls hash the text and run the
+ * compiled statement. The cache is only flushed between evals, never
+ * while a body might be running. */
+
+#define KS_FN_BUCKETS 256
+#define KS_FN_MAX     1024
+
+struct ks_fn {
+    ks_fn *next;
+    unsigned hash;
+    int arity;           /* 2 if the body mentions y, 1 if x, else 0 */
+    ks_stmt st;
+};
+
+struct ks_fcache {
+    ks_fn *buckets[KS_FN_BUCKETS];
+    int count;
+    ks_cmem mem;
+};
+
+
+static ks_fn *fn_lookup(ks_ctx *ctx, const char *body) {
+    struct ks_fcache *fc = ctx->funcs;
+    if (!fc) {
+        fc = ctx->funcs = calloc(1, sizeof(struct ks_fcache));
+        if (!fc) { ctx->last_status = KS_ERR_OOM; longjmp(ctx->recover, 1); }
+    }
+    unsigned h = c_hash(body, (int)strlen(body));
+    ks_fn **slot = &fc->buckets[h % KS_FN_BUCKETS];
+    for (ks_fn *f = *slot; f; f = f->next)
+        if (f->hash == h && strcmp(f->st.src, body) == 0) return f;
+
+    ks_fn *f = c_alloc(ctx, &fc->mem, sizeof(ks_fn));
+    stmt_init(ctx, &f->st, &fc->mem, body, strlen(body));
+    c_dups(ctx, &fc->mem, &f->st, 1);
+    f->hash = h;
+    f->arity = strchr(body, 'y') ? 2 : strchr(body, 'x') ? 1 : 0;
+    f->next = *slot;
+    *slot = f;
+    fc->count++;
+    return f;
+}
+
+static int fn_arity(const ks_fn *f) {
+    return f->arity;
+}
 
-    int is_scan = 0;
-    while (**s == ' ') (*s)++;
-    if (**s == '\\') { is_scan = 1; (*s)++; }
-    K arg = expr(ctx, s);
-    if (is_scan) return scan(ctx, c, arg);
-    else return mo(ctx, c, arg);
+static K fn_run(ks_ctx *ctx, ks_fn *f) {
+    int end;
+    return force(ctx, run_seq(ctx, &f->st, 0, &end));
 }
 
-K e(ks_ctx *ctx, char **s) {
-    K x = expr(ctx, s);
-    while (**s == ' ') (*s)++;
-    while (**s == ';') {
-        (*s)++;
-        if (x) k_free(ctx, x);
-        while (**s == ' ') (*s)++;
-        if (!**s || **s == '\n' || **s == ')' || **s == '}') return k_new(ctx, 0);
-        x = expr(ctx, s);
-        while (**s == ' ') (*s)++;
+static void fn_cache_free(ks_ctx *ctx) {
+    if (!ctx->funcs) return;
+    c_release(&ctx->funcs->mem);
+    free(ctx->funcs);
+    ctx->funcs = NULL;
+}
+
+/* --- Programs ---
+ * ks_compile splits a script into statements the way the API wrapper
+ * always has (top-level ';', newlines and '/' comments), so a whole
+ * patch file compiles to one program. */
+
+static int split_script(const char *code, size_t len,
+                        int (*emit)(void *, const char *, size_t), void *arg) {
+    int paren = 0, brace = 0, bracket = 0;
+    size_t start = 0;
+    for (size_t i = 0; ; i++) {
+        char c = (i < len) ? code[i] : '\0';
+        if (c == '(') paren++;
+        else if (c == ')' && paren > 0) paren--;
+        else if (c == '{') brace++;
+        else if (c == '}' && brace > 0) brace--;
+        else if (c == '[') bracket++;
+        else if (c == ']' && bracket > 0) bracket--;
+
+        int top = (paren == 0 && brace == 0 && bracket == 0);
+        if (!(c == '\0' || (top && (c == ';' || c == '\n' || c == '\r' || c == '/'))))
+            continue;
+
+        size_t a = start, b = i;
+        while (a < b && isspace((unsigned char)code[a])) a++;
+        while (b > a && isspace((unsigned char)code[b - 1])) b--;
+        if (b > a && emit(arg, code + a, b - a) != 0) return -1;
+
+        if (c == '\0') break;
+        if (c == '/') {
+            while (i < len && code[i] != '\n') i++;
+            if (i >= len) break;
+        }
+        start = i + 1;
     }
-    return x;
+    return 0;
+}
+
+static int count_stmt(void *arg, const char *s, size_t n) {
+    (void)s; (void)n;
+    ((ks_program *)arg)->n++;
+    return 0;
+}
+
+/* Each statement compiles its productions into memory of its own, so
+   independent statements can run on different threads. */
+static int add_stmt(void *arg, const char *s, size_t n) {
+    ks_program *prog = arg;
+    ks_stmt *st = &prog->stmts[prog->n++];
+    if (stmt_init(NULL, st, &prog->mem, s, n) != 0) return -1;
+    st->mem = &st->nodes;
+    return 0;
+}
+
+/* Dependencies for reruns. Reads are the letters a statement mentions
+   (plus N for `t`); writes are letters followed by ':'. A statement is
+   rerunnable when it is a single `X: expr` with no r and no function
+   literal, so its value depends on nothing but the variables it reads.
+   A variable is stable when exactly one statement writes it and nothing
+   reads it before then; keeping its old value is then invisible, as
+   long as no function (whose body could read it) is defined. */
+static void c_deps(ks_program *prog) {
+    int writes[26] = {0};
+    unsigned seen = 0, unstable = 0;
+    int funcs = 0;
+    for (int s = 0; s < prog->n; s++) {
+        ks_stmt *st = &prog->stmts[s];
+        const char *t = st->src;
+        int colons = 0, impure = 0;
+        unsigned rd = 0;
+        for (int i = 0; i < st->len; i++) {
+            char ch = t[i];
+            if (ch == ':') colons++;
+            else if (ch == 'r' || ch == '{') impure = 1;
+            else if (ch == 't') rd |= 1u << ('N' - 'A');
+            if (ch == '{') funcs = 1;
+            if (ch >= 'A' && ch <= 'Z' && t[i + 1] != ':') rd |= 1u << (ch - 'A');
+        }
+        seen |= rd;
+        for (int i = 0; i < st->len; i++) {
+            char ch = t[i];
+            if (ch >= 'A' && ch <= 'Z' && t[i + 1] == ':') {
+                writes[ch - 'A']++;
+                st->writes |= 1u << (ch - 'A');
+                if (seen >> (ch - 'A') & 1) unstable |= 1u << (ch - 'A');
+            }
+        }
+        st->reads = rd;
+        st->noise = strchr(t, 'r') != NULL;
+        st->wvar = (st->len > 2 && t[0] >= 'A' && t[0] <= 'Z' && t[1] == ':' &&
+                    colons == 1 && !impure) ? t[0] : 0;
+    }
+    prog->stable = 0;
+    prog->funcs = funcs;
+    if (funcs) return;
+    for (int i = 0; i < 26; i++)
+        if (writes[i] == 1 && !(unstable >> i & 1)) prog->stable |= 1u << i;
+}
+
+ks_program* ks_compile(const char *code, size_t len) {
+    if (!code) return NULL;
+    ks_program *prog = calloc(1, sizeof(ks_program));
+    if (!prog) return NULL;
+    split_script(code, len, count_stmt, prog);
+    int n = prog->n;
+    prog->n = 0;
+    prog->stmts = c_alloc(NULL, &prog->mem, (n ? n : 1) * sizeof(ks_stmt));
+    if (!prog->stmts || split_script(code, len, add_stmt, prog) != 0) {
+        ks_program_free(prog);
+        return NULL;
+    }
+    c_dups(NULL, &prog->mem, prog->stmts, prog->n);
+    c_deps(prog);
+    return prog;
+}
+
+void ks_program_free(ks_program *prog) {
+    if (!prog) return;
+    for (int i = 0; i < prog->n; i++) c_release(&prog->stmts[i].nodes);
+    c_release(&prog->mem);
+    free(prog);
+}
+
+int ks_program_length(const ks_program *prog) {
+    return prog ? prog->n : 0;
 }
 
 /* --- Public API --- */
@@ -849,8 +3556,8 @@ static K k_clone_owned(ks_ctx *ctx, K source) {
     if (!source) return NULL;
     if (k_is_func(source)) {
         int len = (int)strlen((char *)source->f) + 1;
-        int ndoubles = (len + (int)sizeof(double) - 1) / (int)sizeof(double);
-        K copy = k_new_perm(ctx, ndoubles);
+        int nslots = (len + (int)sizeof(ks_real) - 1) / (int)sizeof(ks_real);
+        K copy = k_new_perm(ctx, nslots);
         if (!copy) return NULL;
         copy->n = -1;
         memcpy(copy->f, source->f, (size_t)len);
@@ -860,46 +3567,399 @@ static K k_clone_owned(ks_ctx *ctx, K source) {
     K copy = k_new_perm(ctx, source->n);
     if (!copy) return NULL;
     if (source->n > 0) {
-        memcpy(copy->f, source->f, (size_t)source->n * sizeof(double));
+        memcpy(copy->f, source->f, (size_t)source->n * sizeof(ks_real));
     }
     return copy;
 }
 
-K ks_eval(ks_ctx *ctx, const char *code, size_t len) {
-    if (!ctx || !code) return NULL;
-
+/* Run one statement: a compiled one from a program, or (st == NULL)
+   code compiled into the arena for this call only. */
+static K eval_stmt(ks_ctx *ctx, ks_stmt *st, const char *code, size_t len) {
     ctx->last_status = KS_OK;
     ctx->gas_used = 0;
 
+    /* Nothing is running yet, so an overgrown function cache can go. */
+    if (ctx->funcs && ctx->funcs->count > KS_FN_MAX) fn_cache_free(ctx);
+    memo_sweep(ctx);
+
     /* Save arena position — on longjmp or normal return we reset to here,
        reclaiming all temporaries allocated during this eval in one shot. */
     char *arena_checkpoint = ctx->arena_ptr;
 
-    char *buf = malloc(len + 1);
-    if (!buf) {
-        ctx->last_status = KS_ERR_OOM;
-    } else {
-        memcpy(buf, code, len);
-        buf[len] = '\0';
-    }
-
-    K result = NULL;
-    if (buf && setjmp(ctx->recover) == 0) {
-        char *p_code = buf;
-        result = e(ctx, &p_code);
-        if (result) result = k_clone_owned(ctx, result);
+    /* Only a finished, owned copy is stored in result: a longjmp out of
+       force() must not leave it pointing at an arena temporary. */
+    K volatile result = NULL;
+    if (setjmp(ctx->recover) == 0) {
+        int end;
+        K x = st ? run_seq(ctx, st, 0, &end) : eval_once(ctx, code, len);
+        if (x) result = k_clone_owned(ctx, force(ctx, x));
     }
-    free(buf);
     /* Both the success and longjmp paths fall through here.
        Reset the arena — all temporaries are gone. */
     ctx->arena_ptr  = arena_checkpoint;
     ctx->args[0]    = ctx->args[1] = NULL; /* were arena ptrs, now dangling */
+    loans_settle(ctx);
+    arena_trim(ctx);
 
     /* The returned object is an owned copy. The caller releases it with
        k_free(); all evaluator intermediates were reclaimed above. */
     return result;
 }
 
+K ks_eval(ks_ctx *ctx, const char *code, size_t len) {
+    if (!ctx || !code) return NULL;
+    return eval_stmt(ctx, NULL, code, len);
+}
+
+/* --- Incremental Reruns ---
+ * Each rerunnable assignment that succeeds leaves a record in the
+ * context: its text, the generation it gave its variable, and the
+ * generations of everything it read. A later rerun of the same text
+ * (in this program or an edited one) is skipped while all of those
+ * are unchanged, and the variable keeps its value. Re-running a
+ * statement bumps its variable's generation, which dirties exactly the
+ * statements that read it, and so on down the script. */
+
+#define KS_DEP_SLOTS 256
+
+typedef struct {
+    unsigned hash, reads, wgen;
+    int len;
+    char var;
+    char *text;          /* NULL when the slot is empty */
+    unsigned gen[26];    /* generations of the reads when it ran */
+} ks_dep;
+
+struct ks_deps {
+    ks_dep e[KS_DEP_SLOTS];
+};
+
+static int deps_funcs(ks_ctx *ctx, unsigned reads) {
+    for (int i = 0; i < 26; i++)
+        if ((reads >> i & 1) && k_is_func(ctx->vars[i])) return 1;
+    return 0;
+}
+
+static int dep_clean(ks_ctx *ctx, ks_stmt *st) {
+    if (!st->wvar || !ctx->deps) return 0;
+    unsigned h = c_hash(st->src, st->len);
+    ks_dep *d = &ctx->deps->e[h % KS_DEP_SLOTS];
+    int w = st->wvar - 'A';
+    if (!d->text || d->hash != h || d->len != st->len || d->var != st->wvar ||
+        memcmp(d->text, st->src, st->len) != 0) return 0;
+    if (!ctx->vars[w] || ctx->gen[w] != d->wgen) return 0;
+    for (int i = 0; i < 26; i++)
+        if ((d->reads >> i & 1) && d->gen[i] != ctx->gen[i]) return 0;
+    return !deps_funcs(ctx, d->reads);
+}
+
+/* Best effort: without memory the statement just reruns next time. */
+static void dep_record(ks_ctx *ctx, ks_stmt *st, const unsigned *gen) {
+    if (!ctx->deps && !(ctx->deps = calloc(1, sizeof(struct ks_deps)))) return;
+    unsigned h = c_hash(st->src, st->len);
+    ks_dep *d = &ctx->deps->e[h % KS_DEP_SLOTS];
+    char *text = (d->text && d->len >= st->len) ? d->text : realloc(d->text, st->len);
+    if (!text) return;
+    memcpy(text, st->src, st->len);
+    d->text = text;
+    d->hash = h; d->len = st->len; d->var = st->wvar;
+    d->reads = st->reads;
+    d->wgen = ctx->gen[st->wvar - 'A'];
+    memcpy(d->gen, gen, sizeof d->gen);
+}
+
+static void deps_free(ks_ctx *ctx) {
+    if (!ctx->deps) return;
+    for (int i = 0; i < KS_DEP_SLOTS; i++) free(ctx->deps->e[i].text);
+    free(ctx->deps);
+    ctx->deps = NULL;
+}
+
+/* --- Parallel Statements ---
+ * With ks_set_threads above 1, a program runs in waves: runs of
+ * consecutive statements none of which reads or assigns a variable
+ * that an earlier one in the wave assigns. Statements in a wave do not
+ * see each other's results, so they run side by side, each on a helper
+ * context of its own (own arena, pool, memo and wavetable cache) that
+ * holds copies of the variables it reads. A copy is kept while the
+ * variable's generation is unchanged, so a re-render copies only what
+ * changed. Once the wave is done its results are committed in script
+ * order, and the first statement that failed stops the run there: the
+ * variables, the value returned and the status are a serial run's.
+ *
+ * A wave only goes to helpers when at least two of its statements did
+ * KS_WAVE_WORK or more gas worth of work the last time they ran;
+ * otherwise waking the workers and the copies would cost more than they
+ * save. A program's first run therefore goes in order and teaches the
+ * later ones. Statements that draw from the `r` stream each start a
+ * wave, so the counter passes through them in order. A program that defines a
+ * function, or a statement that reads a variable holding one, runs
+ * in order on the context itself, since a body may read anything. */
+
+#define KS_WAVE_MAX  64
+#define KS_WAVE_WORK (1 << 15)
+
+struct ks_helpers {
+    ks_ctx *ctx[KS_MAX_THREADS];
+};
+
+typedef struct {
+    ks_ctx *ctx;             /* the context the program runs in */
+    ks_stmt *sts;            /* the wave */
+    int run[KS_WAVE_MAX];    /* statements in it that need running */
+    int nrun, tasks;
+    K result[KS_WAVE_MAX];
+    ks_status status[KS_WAVE_MAX];
+    uint64_t rng_ctr;        /* counter after the wave's noise statement */
+} ks_wave;
+
+static void helpers_clear_vars(ks_ctx *ctx) {
+    if (!ctx->helpers) return;
+    for (int t = 0; t < KS_MAX_THREADS; t++)
+        if (ctx->helpers->ctx[t]) ks_clear_vars(ctx->helpers->ctx[t]);
+}
+
+static void helpers_free(ks_ctx *ctx) {
+    if (!ctx->helpers) return;
+    for (int t = 0; t < KS_MAX_THREADS; t++) ks_destroy(ctx->helpers->ctx[t]);
+    free(ctx->helpers);
+    ctx->helpers = NULL;
+}
+
+/* Make sure there are `tasks` helpers, set up like ctx; 0 if out of
+   memory, and the wave then runs in order instead. */
+static int helpers_ready(ks_ctx *ctx, int tasks) {
+    if (!ctx->helpers && !(ctx->helpers = calloc(1, sizeof(struct ks_helpers)))) return 0;
+    for (int t = 0; t < tasks; t++) {
+        ks_ctx *h = ctx->helpers->ctx[t];
+        if (!h && !(h = ctx->helpers->ctx[t] = ks_create(ctx->mem_limit, ctx->gas_limit))) return 0;
+        ks_set_accuracy(h, ctx->accuracy);
+        ks_set_control_rate(h, ctx->control_rate);
+        ks_set_nan_policy(h, ctx->nan_policy);
+        h->gas_limit = ctx->gas_limit;
+        h->arena_keep = ctx->arena_keep;
+        h->rng_seed = ctx->rng_seed;
+        h->rng_ctr = ctx->rng_ctr;
+    }
+    return 1;
+}
+
+/* Statements from i that can run as one wave. */
+static int wave_len(ks_ctx *ctx, const ks_program *prog, int i) {
+    if (!KS_THREADS || ctx->threads < 2 || prog->funcs) return 1;
+    unsigned written = 0;
+    int noise = 0, n = 0;
+    while (i + n < prog->n && n < KS_WAVE_MAX) {
+        const ks_stmt *st = &prog->stmts[i + n];
+        if ((st->reads | st->writes) & written) break;
+        if (st->noise && noise) break;
+        if (deps_funcs(ctx, st->reads)) break;
+        written |= st->writes;
+        noise |= st->noise;
+        n++;
+    }
+    return n;
+}
+
+/* Bring helper h's copies of what st reads up to date, and line up the
+   generations of what it assigns with ctx's; 0 if out of memory. */
+static int helper_load(ks_ctx *ctx, ks_ctx *h, const ks_stmt *st) {
+    unsigned use = st->reads | st->writes;
+    for (int i = 0; i < 26; i++) {
+        if (!(use >> i & 1)) continue;
+        K v = (st->reads >> i & 1) ? ctx->vars[i] : NULL;
+        if (h->gen[i] == ctx->gen[i] && (h->vars[i] != NULL) == (v != NULL)) continue;
+        k_free(h, h->vars[i]);
+        h->vars[i] = v ? k_clone_owned(h, v) : NULL;
+        h->gen[i] = ctx->gen[i];
+        if (v && !h->vars[i]) return 0;
+    }
+    return 1;
+}
+
+static void wave_task(void *arg, int t) {
+    ks_wave *w = arg;
+    ks_ctx *h = w->ctx->helpers->ctx[t];
+    for (int k = t; k < w->nrun; k += w->tasks) {
+        int s = w->run[k];
+        ks_stmt *st = &w->sts[s];
+        if (!helper_load(w->ctx, h, st)) {
+            w->result[s] = NULL;
+            w->status[s] = KS_ERR_OOM;
+            continue;
+        }
+        w->result[s] = eval_stmt(h, st, NULL, 0);
+        w->status[s] = h->last_status;
+        st->work = h->gas_used;
+        if (st->noise) w->rng_ctr = h->rng_ctr;
+    }
+}
+
+/* Take the variables statement st assigned on helper h into ctx, or
+   with keep == 0 throw them away. Either way h's generations match
+   ctx's again, so no stale copy can pass for a current one. */
+static void wave_commit(ks_ctx *ctx, ks_ctx *h, const ks_stmt *st, int keep) {
+    for (int i = 0; i < 26; i++) {
+        if (!(st->writes >> i & 1) || h->gen[i] == ctx->gen[i]) continue;
+        if (keep) {
+            k_free(ctx, ctx->vars[i]);
+            ctx->vars[i] = h->vars[i];
+            ctx->gen[i] = h->gen[i];
+        } else {
+            k_free(h, h->vars[i]);
+            h->gen[i] = ctx->gen[i];
+        }
+        h->vars[i] = NULL;
+    }
+}
+
+/* A rerun assignment that ran without writing its variable (it read an
+   unset one and gave no value) must not leave the value kept from the
+   last render: a run from an empty context would have nothing there. */
+static void rerun_unset(ks_ctx *ctx, const ks_stmt *st, const unsigned *gen) {
+    int w = st->wvar - 'A';
+    if (!st->wvar || ctx->gen[w] != gen[w] || !ctx->vars[w]) return;
+    k_free(ctx, ctx->vars[w]);
+    ctx->vars[w] = NULL;
+    ctx->gen[w]++;
+}
+
+/* Run statements [i, i+n) as a wave. Returns how many it got through,
+   the failing one included (the status says how), or -1 when fewer
+   than two heavy ones need running or helpers could not be set up,
+   and the caller runs statement i in order. */
+static int run_wave(ks_ctx *ctx, ks_program *prog, int i, int n, int incremental, K *last) {
+    ks_wave w;
+    w.ctx = ctx;
+    w.sts = &prog->stmts[i];
+    w.nrun = 0;
+    int heavy = 0;
+    for (int k = 0; k < n; k++)
+        if (!(incremental && dep_clean(ctx, &w.sts[k]))) {
+            w.run[w.nrun++] = k;
+            heavy += w.sts[k].work >= KS_WAVE_WORK;
+        }
+    if (heavy < 2) return -1;
+    w.tasks = w.nrun < ctx->threads ? w.nrun : ctx->threads;
+    if (!helpers_ready(ctx, w.tasks)) return -1;
+    w.rng_ctr = ctx->rng_ctr;
+    for (int k = 0; k < n; k++) w.result[k] = NULL;
+
+    unsigned gen[26];
+    memcpy(gen, ctx->gen, sizeof gen);
+    par_run(ctx, w.tasks, wave_task, &w);
+
+    for (int k = 0, r = 0; k < n; k++) {
+        ks_stmt *st = &w.sts[k];
+        K result;
+        if (r < w.nrun && w.run[r] == k) {
+            ks_ctx *h = ctx->helpers->ctx[r % w.tasks];
+            r++;
+            wave_commit(ctx, h, st, 1);
+            if (st->noise) ctx->rng_ctr = w.rng_ctr;
+            ctx->last_status = w.status[k];
+            result = w.result[k];
+            w.result[k] = NULL;
+            if (incremental && ctx->last_status == KS_OK) rerun_unset(ctx, st, gen);
+            if (incremental && st->wvar && !deps_funcs(ctx, st->reads) && ctx->last_status == KS_OK)
+                dep_record(ctx, st, gen);
+        } else {
+            result = k_clone_owned(ctx, ctx->vars[st->wvar - 'A']);
+        }
+        if (*last) k_free(ctx, *last);
+        *last = result;
+        if (ctx->last_status != KS_OK) {
+            for (; r < w.nrun; r++) {
+                int j = w.run[r];
+                wave_commit(ctx, ctx->helpers->ctx[r % w.tasks], &w.sts[j], 0);
+                if (w.result[j]) k_free(ctx, w.result[j]);
+            }
+            return k + 1;
+        }
+    }
+    return n;
+}
+
+/* A rerun that stopped at statement f: drop the kept (stable) variables
+   that only statements from f on write and that this run did not
+   write before the fault. They still hold the last render's values,
+   which a run from ks_program_clear_vars would not have. */
+static void rerun_drop(ks_ctx *ctx, const ks_program *prog, int f, const unsigned *gen) {
+    unsigned done = 0;
+    for (int s = 0; s < f; s++) done |= prog->stmts[s].writes;
+    for (int i = 0; i < 26; i++) {
+        if (!(prog->stable >> i & 1) || (done >> i & 1) || ctx->gen[i] != gen[i] || !ctx->vars[i]) continue;
+        k_free(ctx, ctx->vars[i]);
+        ctx->vars[i] = NULL;
+        ctx->gen[i]++;
+    }
+}
+
+static K run_program(ks_ctx *ctx, ks_program *prog, int incremental) {
+    if (!ctx || !prog) return NULL;
+    K last = NULL;
+    unsigned start[26];
+    memcpy(start, ctx->gen, sizeof start);
+    ctx->last_status = KS_OK;
+    for (int i = 0, n; i < prog->n; i += n) {
+        n = wave_len(ctx, prog, i);
+        if (n < 2 || (n = run_wave(ctx, prog, i, n, incremental, &last)) < 0) {
+            n = 1;
+            ks_stmt *st = &prog->stmts[i];
+            K result;
+            if (incremental && dep_clean(ctx, st)) {
+                result = k_clone_owned(ctx, ctx->vars[st->wvar - 'A']);
+            } else {
+                unsigned gen[26];
+                int record = incremental && st->wvar && !deps_funcs(ctx, st->reads);
+                memcpy(gen, ctx->gen, sizeof gen);
+                result = eval_stmt(ctx, st, NULL, 0);
+                st->work = ctx->gas_used;
+                if (incremental && ctx->last_status == KS_OK) rerun_unset(ctx, st, gen);
+                if (record && ctx->last_status == KS_OK) dep_record(ctx, st, gen);
+            }
+            if (last) k_free(ctx, last);
+            last = result;
+        }
+        if (ctx->last_status != KS_OK) {
+            if (last) k_free(ctx, last);
+            if (incremental) rerun_drop(ctx, prog, i + n - 1, start);
+            return NULL;
+        }
+    }
+    return last;
+}
+
+/* Statements run in order, each as its own eval; the first error stops
+   the run. Returns the last statement's value (owned, like ks_eval). */
+K ks_program_run(ks_ctx *ctx, ks_program *prog) {
+    return run_program(ctx, prog, 0);
+}
+
+/* Like ks_program_run, but assignments whose inputs are unchanged since
+   they last ran in this context keep their value instead of running.
+   When a statement fails, variables the program writes once and that
+   nothing before the failure wrote are cleared, as a run after
+   ks_program_clear_vars would leave them. */
+K ks_program_rerun(ks_ctx *ctx, ks_program *prog) {
+    return run_program(ctx, prog, 1);
+}
+
+/* Clear every variable except those the program writes once and never
+   reads first: afterwards a rerun gives what a run on an empty context
+   would, without recomputing the kept ones. */
+void ks_program_clear_vars(ks_ctx *ctx, const ks_program *prog) {
+    if (!ctx) return;
+    unsigned keep = prog ? prog->stable : 0;
+    for (int i = 0; i < 26; i++) {
+        if ((keep >> i & 1) || !ctx->vars[i]) continue;
+        k_free(ctx, ctx->vars[i]);
+        ctx->vars[i] = NULL;
+        ctx->gen[i]++;
+    }
+    ctx->args[0] = ctx->args[1] = NULL;
+}
+
 void p(ks_ctx *ctx, K x) {
     (void)ctx;
     if (!x) { printf("(null)\n"); return; }
@@ -3,9 +3,13 @@
  *
  * An array-oriented, right-associative DSP language and evaluation engine.
  * * Architecture:
- * - K Struct: Represents a vector of doubles. Contains a refcount (r),
+ * - K Struct: Represents a vector of ks_real (double, or float with
+ * KS_FLOAT32). Contains a refcount (r),
  * length (n), and a flexible array member (f) for the payload. Length
  * -1 indicates a function object.
+ * - Programs: `ks_compile` turns a script into per-statement nodes
+ * memoised by source offset; `ks_program_run` executes them without
+ * re-parsing. `ks_eval` is a compile-and-run of one statement.
  * * Memory Model:
  * - Arena (Bump Allocator): Fast, temporary allocations used for all
  * intermediate vectors during a single `ks_eval` pass. The entire arena
@@ -34,7 +38,36 @@ typedef enum {
     KS_ERR_INTERNAL      /* Unexpected internal error */
 } ks_status;
 
-typedef struct { int r, n; double f[]; } *K;
+/* Vector element type. Build every translation unit with -DKS_FLOAT32
+   to store and compute vectors in single precision: half the memory
+   traffic, twice the SIMD width. Running sums and phases still
+   accumulate in double. */
+#ifdef KS_FLOAT32
+typedef float ks_real;
+#else
+typedef double ks_real;
+#endif
+
+typedef struct { int r, n; ks_real f[]; } *K;
+
+/* How the transcendental verbs (s c t h d l e x n) are computed:
+   KS_EXACT calls libm for every element; KS_FAST uses vectorised
+   polynomial kernels, within a few ulp of libm. */
+typedef enum {
+    KS_EXACT = 0,
+    KS_FAST
+} ks_accuracy;
+
+/* How far the recursive verbs (f g y) run before clamping their state
+   (NaN and inf to 0, anything else to +-1e6): KS_NAN_SAMPLE every
+   sample; KS_NAN_BLOCK every KS_NAN_BLOCK_LEN samples; KS_NAN_OUTPUT
+   only the finished output. The output is clamped under all three. */
+typedef enum {
+    KS_NAN_SAMPLE = 0,
+    KS_NAN_BLOCK,
+    KS_NAN_OUTPUT
+} ks_nan_policy;
+#define KS_NAN_BLOCK_LEN 256
 
 typedef struct ks_ctx {
     K vars[26];          /* A-Z user variables (persistent, malloc'd) */
@@ -44,12 +77,33 @@ typedef struct ks_ctx {
     char  *arena_base;   /* Start of arena block */
     char  *arena_ptr;    /* Current bump position */
     char  *arena_end;    /* One past end of arena block */
+    char  *arena_commit; /* One past end of the pages backed by memory */
+    size_t arena_keep;   /* Commit kept across evals (KS_ARENA_KEEP_ALL) */
+    size_t arena_peak;   /* Most bytes ever committed */
 
     size_t mem_limit;    /* Arena size (bytes); set at ks_create time */
 
     long long gas_limit; /* Max operations allowed for evaluation */
     long long gas_used;  /* Current operations consumed */
 
+    struct ks_fcache *funcs; /* Compiled function bodies, keyed by text */
+    struct ks_memo *memo;    /* Remembered common subexpressions */
+    struct ks_deps *deps;    /* Inputs seen by each assignment, for reruns */
+    struct ks_loans *loans;  /* Var buffers lent to the running eval */
+    struct ks_pool *pool;    /* Recycled perm buffers by size class */
+    struct ks_wtabs *wtabs;  /* Band-limited copies of `t` tables */
+    struct ks_helpers *helpers; /* Contexts that run statements side by side */
+    struct ks_workers *workers; /* Threads that long kernels split across */
+    unsigned gen[26];        /* Bumped on every write to vars[i] */
+    ks_accuracy accuracy;    /* Transcendental verbs; set with ks_set_accuracy */
+    int threads;             /* Threads a kernel may use; set with ks_set_threads */
+    int par_min;             /* Elements per thread before a split; ks_set_par_min */
+    int control_rate;        /* Samples per `g` coefficient; ks_set_control_rate */
+    ks_nan_policy nan_policy; /* Clamping in f g y; set with ks_set_nan_policy */
+    double *sin_tab;         /* Quarter-wave sine for control-rate `g` */
+    uint64_t rng_seed;       /* Noise stream for `r`; set with ks_seed */
+    uint64_t rng_ctr;        /* Noise samples drawn since the seed */
+
     jmp_buf recover;     /* Eval-local escape for explicit checked errors */
     ks_status last_status;
     char last_err_msg[256];
@@ -60,16 +114,65 @@ ks_ctx* ks_create(size_t mem_limit, long long gas_limit);
 void ks_destroy(ks_ctx *ctx);
 void ks_clear_vars(ks_ctx *ctx);
 
+/* Arena memory: mem_limit is reserved address space; pages are committed
+   as evals reach them. After each eval, commit above the keep size is
+   handed back to the OS. */
+#define KS_ARENA_KEEP_ALL ((size_t)-1)
+typedef struct {
+    size_t reserved;     /* mem_limit */
+    size_t committed;    /* bytes backed by memory right now */
+    size_t peak;         /* most bytes ever committed */
+} ks_arena_stats;
+void ks_arena_keep(ks_ctx *ctx, size_t bytes);   /* default KS_ARENA_KEEP_ALL */
+void ks_arena_get_stats(const ks_ctx *ctx, ks_arena_stats *out);
+
+/* Accuracy of the transcendental verbs; default KS_EXACT. */
+void ks_set_accuracy(ks_ctx *ctx, ks_accuracy acc);
+
+/* Threads (the calling one included) that long kernels may split work
+   across; default 1. Results do not depend on it. */
+#define KS_MAX_THREADS 64
+void ks_set_threads(ks_ctx *ctx, int n);
+
+/* Elements a kernel needs per thread before it splits across them;
+   default KS_PAR_MIN. Only speed depends on it. */
+#define KS_PAR_MIN (1 << 16)
+void ks_set_par_min(ks_ctx *ctx, int n);
+
+/* Swept `g` cutoffs: work the coefficient out every k samples (from a
+   table sine) and interpolate between; default 1, every sample exactly. */
+#define KS_MAX_CONTROL_RATE 1024
+void ks_set_control_rate(ks_ctx *ctx, int k);
+
+/* Clamping in the recursive verbs; default KS_NAN_SAMPLE. The
+   policies differ only once a filter or delay has run away. */
+void ks_set_nan_policy(ks_ctx *ctx, ks_nan_policy p);
+
+/* Restart the context's noise stream (`r`) from seed; a new context
+   starts at seed 0. The same seed always gives the same samples. */
+void ks_seed(ks_ctx *ctx, uint64_t seed);
+
 /* Evaluation API */
 K ks_eval(ks_ctx *ctx, const char *code, size_t len);
+
+/* Compiled programs: parse a script once, run it many times. A program
+   holds no context state; run it against any context. Not safe to run
+   one program on two threads at once (productions compile on first use). */
+typedef struct ks_program ks_program;
+ks_program* ks_compile(const char *code, size_t len);
+K ks_program_run(ks_ctx *ctx, ks_program *prog);
+K ks_program_rerun(ks_ctx *ctx, ks_program *prog);       /* skip unchanged assignments */
+void ks_program_clear_vars(ks_ctx *ctx, const ks_program *prog);
+int ks_program_length(const ks_program *prog);
+void ks_program_free(ks_program *prog);
 const char* ks_strerror(ks_status status);
 ks_status ks_bind_vector(ks_ctx *ctx, char name, const double *values,
                          size_t length);
 
 /* Internal-ish K Lifecycle */
 K k_new(ks_ctx *ctx, int n);       /* arena-allocated (eval lifetime) */
-K k_new_perm(ks_ctx *ctx, int n);  /* malloc'd (persists across evals, e.g. vars) */
-void k_free(ks_ctx *ctx, K x);     /* no-op for arena objects; refcount-free for perm objects */
+K k_new_perm(ks_ctx *ctx, int n);  /* pooled (persists across evals, e.g. vars); release with k_free */
+void k_free(ks_ctx *ctx, K x);     /* drops a reference; perm objects are freed at zero */
 
 /* Function support */
 K k_func(ks_ctx *ctx, char *body);
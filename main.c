@@ -67,7 +67,7 @@ void cb(ma_device* d, void* o, const void* i, ma_uint32 n) {
   }
 }
 
-int write_wav_from_k(char* name, double* ptr, ma_uint64 frames, ma_uint32 chans, ma_uint32 sample_rate);
+int write_wav_from_k(char* name, ks_real* ptr, ma_uint64 frames, ma_uint32 chans, ma_uint32 sample_rate);
 void p_view(K x, int opts);
 
 void handle_play(char *ptr) {
@@ -101,6 +101,47 @@ static char *trim_ws(char *s) {
   return s;
 }
 
+// Load a plain script (no \ command lines) as one compiled program.
+// Reloading an edited file only recomputes the assignments whose text
+// or inputs changed. The first failing statement stops the load and
+// nothing after it runs. Returns 0 if the file has commands or show
+// (\t) is on; the caller then feeds it line by line, echoing each
+// line and its value and carrying on past errors.
+static int load_script(ks_ctx *ctx, FILE *f) {
+  if (show) return 0;
+  char line[1024];
+  size_t len = 0, cap = 0;
+  char *src = NULL;
+  while (fgets(line, sizeof(line), f)) {
+    char *s = line;
+    while (*s == ' ' || *s == '\t') s++;
+    if (*s == '\\') { free(src); rewind(f); return 0; }
+    size_t n = strlen(line);
+    if (len + n + 1 > cap) {
+      cap = (len + n + 1) * 2;
+      char *grown = realloc(src, cap);
+      if (!grown) { free(src); rewind(f); return 0; }
+      src = grown;
+    }
+    memcpy(src + len, line, n + 1);
+    len += n;
+  }
+  if (!src) return 1;
+
+  ks_program *prog = ks_compile(src, len);
+  free(src);
+  if (!prog) { rewind(f); return 0; }
+  K r = ks_program_rerun(ctx, prog);
+  if (ctx->last_status != KS_OK) {
+    printf("/ %d : %s (load stopped)\n", ctx->last_status, ks_strerror(ctx->last_status));
+  } else {
+    ctx->gas_used = 0;
+  }
+  k_free(ctx, r);
+  ks_program_free(prog);
+  return 1;
+}
+
 static void handle_line_single(ks_ctx *ctx, char* line, size_t len) {
   while (*line == ' ') line++;
 
@@ -173,6 +214,7 @@ static void handle_line_single(ks_ctx *ctx, char* line, size_t len) {
       printf("/ \\l (load) %p : {%s}\n", ctx, fn);
       FILE *f = fopen(fn, "r");
       if (!f) { printf("/ Error: %s\n", fn); return; }
+      if (load_script(ctx, f)) { fclose(f); return; }
       char buf[1024];
       while (fgets(buf, sizeof(buf), f)) {
         buf[strcspn(buf, "\n")] = 0;
@@ -417,7 +459,7 @@ void handle_line(ks_ctx *ctx, char* line, size_t len) {
   free(expr_group);
 }
 
-void print_scope(double *data, int len, int width, int height);
+void print_scope(ks_real *data, int len, int width, int height);
 void p_view(K x, int opts) {
   if (!x || x->n <= 0) {
     printf("[0]\n");
@@ -441,7 +483,7 @@ void p_view(K x, int opts) {
 
 #define CHUNK_FRAME_COUNT 4096
 
-int write_wav_from_k(char* filename, double* ptr, ma_uint64 frames, ma_uint32 chans, ma_uint32 sample_rate) {
+int write_wav_from_k(char* filename, ks_real* ptr, ma_uint64 frames, ma_uint32 chans, ma_uint32 sample_rate) {
   ma_result result;
   ma_encoder encoder;
   ma_encoder_config config;
@@ -465,7 +507,7 @@ int write_wav_from_k(char* filename, double* ptr, ma_uint64 frames, ma_uint32 ch
       frames_to_process = CHUNK_FRAME_COUNT;
     }
 
-    // Convert double -> float into our stack-allocated chunk
+    // Convert samples to float into our stack-allocated chunk
     for (ma_uint64 i = 0; i < frames_to_process * chans; ++i) {
       chunk_buffer[i] = (float)ptr[frames_processed * chans + i];
     }
@@ -736,7 +778,7 @@ void draw_line(unsigned char *grid, int x1, int y1, int x2, int y2, int w, int h
  * width:  Desired width in pixels (Braille chars use 2px width each)
  * height: Desired height in pixels (Braille chars use 4px height each)
  */
-void print_scope(double *data, int len, int width, int height) {
+void print_scope(ks_real *data, int len, int width, int height) {
     if (len < 2) return;
 
     // 1. Auto-Scale: Find the actual range of the data
@@ -12,6 +12,14 @@ static ks_ctx *g_ctx = NULL;
 
 #define k_free(x) k_free(g_ctx, (x))
 
+/* KS_FLOAT32 builds store every element in single precision, so each
+   comparison also allows for float rounding of the expected value. */
+#ifdef KS_FLOAT32
+#define TOL(tol, want) ((tol) + 4e-6 * (1.0 + fabs(want)))
+#else
+#define TOL(tol, want) (tol)
+#endif
+
 static void reset_vars(void) {
     ks_clear_vars(g_ctx);
 }
@@ -32,7 +40,7 @@ static void check_scalar(const char *label, const char *src, double expected, do
     }
     double got = x->f[0];
     k_free(x);
-    if (fabs(got - expected) <= tol) {
+    if (fabs(got - expected) <= TOL(tol, expected)) {
         printf("pass [%s]: %.6f\n", label, got);
         pass++;
     } else {
@@ -70,7 +78,7 @@ static void check_elem(const char *label, const char *src, int idx, double expec
     }
     double got = x->f[idx];
     k_free(x);
-    if (fabs(got - expected) <= tol) {
+    if (fabs(got - expected) <= TOL(tol, expected)) {
         printf("pass [%s]: [%d]=%.6f\n", label, idx, got);
         pass++;
     } else {
@@ -248,7 +256,11 @@ static void test_exp_log(void) {
     printf("\n-- e exp, l log --\n");
     check_scalar("e0=1",    "e 0",   1.0,       1e-9);
     check_scalar("e1=e",    "e 1",   2.718281828, 1e-6);
+#ifdef KS_FLOAT32
+    check_scalar("e clamp", "e 200", exp(88),   1e-3);  /* clamped at 88 */
+#else
     check_scalar("e clamp", "e 200", exp(100),  1e-3);  /* clamped at 100 */
+#endif
     check_scalar("l e=1",   "l 2.718281828", 1.0, 1e-6);
     check_scalar("l guard", "l 0",   log(1e-10), 1e-6); /* log(0) guarded */
 }
@@ -534,7 +546,7 @@ static void test_dollar_basic(void) {
         double d = fabs(a->f[i] - b->f[i]);
         if (d > maxdiff) maxdiff = d;
     }
-    if (maxdiff < 1e-9) { printf("pass [$ h1 == s P]\n"); pass++; }
+    if (maxdiff < TOL(1e-9, 1.0)) { printf("pass [$ h1 == s P]\n"); pass++; }
     else                 { printf("FAIL [$ h1 max diff=%.2e]\n", maxdiff); fail++; }
     k_free(a); k_free(b);
 }
@@ -647,7 +659,7 @@ static void test_dollar_vs_o(void) {
         double d = fabs(wo->f[i] - wd->f[i]);
         if (d > maxdiff) maxdiff = d;
     }
-    if (maxdiff < 1e-9) { printf("pass [$ matches o for equal amps, maxdiff=%.2e]\n", maxdiff); pass++; }
+    if (maxdiff < TOL(1e-9, 3.0)) { printf("pass [$ matches o for equal amps, maxdiff=%.2e]\n", maxdiff); pass++; }
     else                 { printf("FAIL [$/o maxdiff=%.2e]\n", maxdiff); fail++; }
     k_free(wo); k_free(wd);
 }
@@ -905,6 +917,988 @@ static void test_host_array_helpers(void) {
     k_free(sum);
 }
 
+static void test_compiled_program(void) {
+    printf("\n-- ks_compile / ks_program_run --\n");
+    reset_vars();
+    const char *src = "/ ramp sum\nT: !N\nW: +T";
+    ks_program *prog = ks_compile(src, strlen(src));
+    if (!prog) { printf("FAIL [compile NULL]\n"); fail++; return; }
+    if (ks_program_length(prog) == 2) { printf("pass [program has 2 statements]\n"); pass++; }
+    else { printf("FAIL [program length=%d]\n", ks_program_length(prog)); fail++; }
+
+    /* same program, different bound variables */
+    double want[2] = {6.0, 10.0};
+    for (int i = 0; i < 2; i++) {
+        bind_scalar(g_ctx, 'N', 4.0 + i);
+        K w = ks_program_run(g_ctx, prog);
+        if (w && w->n == 1 && fabs(w->f[0] - want[i]) < 1e-9) {
+            printf("pass [program run N=%d -> %.0f]\n", 4 + i, want[i]); pass++;
+        } else {
+            printf("FAIL [program run N=%d]\n", 4 + i); fail++;
+        }
+        if (w) k_free(w);
+    }
+    ks_program_free(prog);
+
+    /* value-dependent parses are decided per run */
+    src = "1 N";
+    prog = ks_compile(src, strlen(src));
+    bind_scalar(g_ctx, 'N', 5.0);
+    K a = ks_program_run(g_ctx, prog);
+    run("N: 1 2");
+    K b = ks_program_run(g_ctx, prog);
+    if (a && a->n == 3 && fabs(a->f[1] - 5.0) < 1e-9 && !b) {
+        printf("pass [strand re-decided between runs]\n"); pass++;
+    } else {
+        printf("FAIL [strand re-decided between runs]\n"); fail++;
+    }
+    if (a) k_free(a);
+    if (b) k_free(b);
+    ks_program_free(prog);
+
+    src = "F: {x*2}; F (1 2)";
+    prog = ks_compile(src, strlen(src));
+    K c = ks_program_run(g_ctx, prog);
+    if (c && c->n == 2 && fabs(c->f[1] - 4.0) < 1e-9) { printf("pass [program fn apply]\n"); pass++; }
+    else { printf("FAIL [program fn apply]\n"); fail++; }
+    if (c) k_free(c);
+    ks_program_free(prog);
+}
+
+static void test_function_cache(void) {
+    printf("\n-- compiled function bodies --\n");
+    reset_vars();
+    /* same body called many times, then a different body under the same name */
+    run("F: {x*x}");
+    check_scalar("cached fn first call",  "F 3",          9.0, 1e-9);
+    check_scalar("cached fn repeat call", "+F F F 1 2", 257.0, 1e-9);
+    run("F: {x+x}");
+    check_scalar("fn redefined",          "F 3",          6.0, 1e-9);
+    /* arity is still taken from the body: a dyadic body needs two args */
+    run("G: {x-y}");
+    check_scalar("dyadic fn",             "5 G 2",        3.0, 1e-9);
+    check_len   ("dyadic fn one arg",     "G 2",          0);
+    /* a body that calls another function */
+    run("H: {F G x}");
+    check_len   ("nested fn one arg",     "H 2",          0);
+    run("H: {1+F x}");
+    check_scalar("nested fn",             "H 4",          9.0, 1e-9);
+}
+
+static void test_fused_chain(void) {
+    printf("\n-- fused element-wise chains --\n");
+    reset_vars();
+    run("N: 1000");
+    run("T: !N");
+    /* same chain, fused in one expression vs. staged through variables */
+    K f = run("(s T*0.01)*e(T*(0-6.9%N))");
+    run("A: T*0.01"); run("A: s A");
+    run("B: T*(0-6.9%N)"); run("B: e B");
+    K g = run("A*B");
+    int same = f && g && f->n == 1000 && g->n == 1000;
+    for (int i = 0; same && i < 1000; i++) same = (f->f[i] == g->f[i]);
+    if (same) { printf("pass [fused chain == staged]\n"); pass++; }
+    else { printf("FAIL [fused chain == staged]\n"); fail++; }
+    if (f) k_free(f);
+    if (g) k_free(g);
+    /* mixed lengths still cycle the shorter side */
+    check_len   ("cycle len",    "(1+!4)*1 10",     4);
+    check_elem  ("cycle [3]",    "(1+!4)*1 10", 3, 40.0, 1e-9);
+    /* a fused value is materialised before assignment and function calls */
+    run("F: {+x}");
+    check_scalar("fused into fn", "F 2*!N",    999000.0, 1e-6);
+    check_scalar("fused assign",  "+C: 1+!N",  500500.0, 1e-6);
+    check_elem  ("fused var",     "C",  999,   1000.0, 1e-9);
+}
+
+static void test_lazy_generators(void) {
+    printf("\n-- lazy generators --\n");
+    reset_vars();
+    run("N: 8");
+    check_len   ("iota in chain",   "2*!N",            8);
+    check_elem  ("iota in chain [7]", "2*!N",   7,    14.0, 1e-9);
+    check_elem  ("ramp in chain",   "s ~N",     2,     1.0, 1e-9);
+    check_len   ("tile",            "N#1 2 3",         8);
+    check_elem  ("tile wraps",      "N#1 2 3",  7,     2.0, 1e-9);
+    /* running sum of a tile in closed form: 1 3 6 7 9 12 13 15 */
+    check_len   ("+\\ tile len",   "+\\(N#1 2 3)",     8);
+    check_elem  ("+\\ tile [5]",   "+\\(N#1 2 3)", 5, 12.0, 1e-9);
+    check_elem  ("+\\ tile [7]",   "+\\(N#1 2 3)", 7, 15.0, 1e-9);
+    check_scalar("+\\ tile sum",   "+(+\\(N#1 2 3))",  66.0, 1e-9);
+    /* a long phase ramp stays close to n*inc */
+    check_elem  ("+\\ const tile", "+\\(100000#0.0627)", 99999, 6270.0, 1e-6);
+    /* generators that reach a consumer on their own are filled as before */
+    check_elem  ("gen assigned",    "G: !N",    3,     3.0, 1e-9);
+    check_len   ("iota 1",          "!1",              1);
+    check_len   ("iota 0",          "!0",              0);
+}
+
+static void test_fold_and_cse(void) {
+    printf("\n-- constant folding / common subexpressions --\n");
+    reset_vars();
+    check_scalar("fold scalar",  "440*(6.28318%44100)", 440.0 * (6.28318 / 44100.0), 1e-12);
+    check_elem  ("fold vector",  "2*(1 2 3)+1",  2,  8.0, 1e-9);
+    check_elem  ("fold mono",    "s 0 1",        1,  sin(1.0), 1e-12);
+    check_scalar("fold div0",    "1%0",              0.0, 1e-9);
+
+    /* a repeated subexpression is computed once per program run */
+    const char *src = "N: 5000\nT: !N\nE: e(T*(0-6.9%N))\nA: (s T)*e(T*(0-6.9%N))";
+    ks_program *prog = ks_compile(src, strlen(src));
+    K a = ks_program_run(g_ctx, prog);
+    long long shared = g_ctx->gas_used;
+    K b = run("(s T)*e(T*(0-6.9%N))");
+    long long alone = g_ctx->gas_used;
+    int same = a && b && a->n == 5000 && b->n == 5000;
+    for (int i = 0; same && i < 5000; i++) same = (a->f[i] == b->f[i]);
+    if (same && shared < alone) { printf("pass [cse reuse %lld < %lld gas]\n", shared, alone); pass++; }
+    else { printf("FAIL [cse reuse same=%d gas %lld vs %lld]\n", same, shared, alone); fail++; }
+    if (a) k_free(a);
+    if (b) k_free(b);
+    ks_program_free(prog);
+
+    /* ...but not after a variable it reads has changed */
+    src = "T: !4\nE: +e(T*0.5)\nT: !2\nA: +e(T*0.5)";
+    prog = ks_compile(src, strlen(src));
+    a = ks_program_run(g_ctx, prog);
+    if (a && a->n == 1 && fabs(a->f[0] - (1.0 + exp(0.5))) < TOL(1e-9, 2.6)) { printf("pass [cse invalidated]\n"); pass++; }
+    else { printf("FAIL [cse invalidated]\n"); fail++; }
+    if (a) k_free(a);
+    ks_program_free(prog);
+}
+
+static void test_incremental_rerun(void) {
+    printf("\n-- incremental reruns --\n");
+    reset_vars();
+    const char *src = "N: 100\nT: !N\nA: +T\nB: A*2";
+    ks_program *prog = ks_compile(src, strlen(src));
+    K a = ks_program_rerun(g_ctx, prog);
+    unsigned t_gen = g_ctx->gen['T'-'A'], b_gen = g_ctx->gen['B'-'A'];
+    K b = ks_program_rerun(g_ctx, prog);
+    if (a && b && fabs(b->f[0] - 9900.0) < 1e-9 &&
+        g_ctx->gen['T'-'A'] == t_gen && g_ctx->gen['B'-'A'] == b_gen) {
+        printf("pass [unchanged rerun skips all]\n"); pass++;
+    } else {
+        printf("FAIL [unchanged rerun skips all]\n"); fail++;
+    }
+    if (a) k_free(a);
+    if (b) k_free(b);
+    ks_program_free(prog);
+
+    /* edit one line: only it and what reads it run again */
+    src = "N: 100\nT: !N\nA: 1++T\nB: A*2";
+    prog = ks_compile(src, strlen(src));
+    ks_program_clear_vars(g_ctx, prog);
+    b = ks_program_rerun(g_ctx, prog);
+    if (b && fabs(b->f[0] - 9902.0) < 1e-9 &&
+        g_ctx->gen['T'-'A'] == t_gen && g_ctx->gen['B'-'A'] != b_gen) {
+        printf("pass [edit reruns dependents only]\n"); pass++;
+    } else {
+        printf("FAIL [edit reruns dependents only]\n"); fail++;
+    }
+    if (b) k_free(b);
+
+    ks_program_free(prog);
+
+    /* a host write to an input dirties its readers */
+    src = "T: !N\nA: 1++T\nB: A*2";
+    prog = ks_compile(src, strlen(src));
+    bind_scalar(g_ctx, 'N', 10.0);
+    b = ks_program_rerun(g_ctx, prog);
+    if (b) k_free(b);
+    bind_scalar(g_ctx, 'N', 20.0);
+    b = ks_program_rerun(g_ctx, prog);
+    if (b) k_free(b);
+    check_scalar("rerun after bind", "B", 2.0 * 191.0, 1e-9);
+    ks_program_free(prog);
+
+    /* a variable read before it is written is not kept */
+    src = "D: 0+C\nC: 1 2";
+    prog = ks_compile(src, strlen(src));
+    b = ks_program_rerun(g_ctx, prog);
+    if (b) k_free(b);
+    ks_program_clear_vars(g_ctx, prog);
+    if (!g_ctx->vars['C'-'A']) { printf("pass [read-first var cleared]\n"); pass++; }
+    else { printf("FAIL [read-first var cleared]\n"); fail++; }
+    ks_program_free(prog);
+
+    /* a render that fails keeps nothing from the last one past the fault */
+    reset_vars();
+    src = "N: 3\nA: !N\nB: A*2\nW: B";
+    prog = ks_compile(src, strlen(src));
+    b = ks_program_rerun(g_ctx, prog);
+    if (b) k_free(b);
+    ks_program_free(prog);
+    src = "N: 3\nA: !N\nA,!2000000\nB: A*2\nW: B";
+    prog = ks_compile(src, strlen(src));
+    ks_program_clear_vars(g_ctx, prog);
+    b = ks_program_rerun(g_ctx, prog);
+    if (!b && g_ctx->last_status == KS_ERR_INVALID_ARGS && g_ctx->vars['A'-'A'] &&
+        !g_ctx->vars['B'-'A'] && !g_ctx->vars['W'-'A']) {
+        printf("pass [failed rerun drops later vars]\n"); pass++;
+    } else {
+        printf("FAIL [failed rerun drops later vars]\n"); fail++;
+    }
+    if (b) k_free(b);
+    ks_program_free(prog);
+
+    /* an edit that reads an unset variable leaves nothing from before */
+    reset_vars();
+    src = "N: 100\nA: !N\nB: (A%N)*0.5\nW: B";
+    prog = ks_compile(src, strlen(src));
+    b = ks_program_rerun(g_ctx, prog);
+    if (b) k_free(b);
+    ks_program_free(prog);
+    src = "N: 100\nA: !N\nB: (A%N)*Q\nW: B";
+    prog = ks_compile(src, strlen(src));
+    ks_program_clear_vars(g_ctx, prog);
+    b = ks_program_rerun(g_ctx, prog);
+    if (!g_ctx->vars['B'-'A'] && !g_ctx->vars['W'-'A']) {
+        printf("pass [unset input drops kept var]\n"); pass++;
+    } else {
+        printf("FAIL [unset input drops kept var]\n"); fail++;
+    }
+    if (b) k_free(b);
+    ks_program_free(prog);
+}
+
+static void test_inplace_temporaries(void) {
+    printf("\n-- in-place temporaries --\n");
+    /* 20 chained scans over 40000 samples need 20 x 320 KB without reuse;
+       a 1 MB arena only fits them if dead temporaries are written over. */
+    ks_ctx *small = ks_create(1024 * 1024, 0);
+    const char *src = "+\\+\\+\\+\\+\\+\\+\\+\\+\\+\\+\\+\\+\\+\\+\\+\\+\\+\\+\\+\\(40000#0)";
+    K x = ks_eval(small, src, strlen(src));
+    if (x && x->n == 40000 && small->last_status == KS_OK) { printf("pass [chain fits small arena]\n"); pass++; }
+    else { printf("FAIL [chain fits small arena: %s]\n", ks_strerror(small->last_status)); fail++; }
+    if (x) (k_free)(small, x);
+    ks_destroy(small);
+
+    /* a function argument used twice is never overwritten */
+    reset_vars();
+    run("F: {(+\\x)+x}");
+    check_elem  ("arg reused",   "F 1 2 3",  2,  9.0, 1e-9);
+    run("G: {(x*0)+(1+x)}");
+    check_elem  ("arg after temp", "G !5",  4,   5.0, 1e-9);
+    /* both operands of a cycling dyad stay intact */
+    check_elem  ("cycle reuse",  "(+\\1 2 3 4)+(+\\1 2)", 3, 13.0, 1e-9);
+}
+
+static void test_statement_reclaim(void) {
+    printf("\n-- statement-scoped arena --\n");
+    /* each statement leaves a 480 KB scan behind; a 1 MB arena only
+       runs the sequence if the arena is reclaimed at every `;` */
+    ks_ctx *small = ks_create(1024 * 1024, 0);
+    const char *src = "A: +\\!60000; B: +\\!60000; C: +\\!60000; D: +\\!60000; A+D";
+    K x = ks_eval(small, src, strlen(src));
+    if (x && x->n == 60000 && fabs(x->f[3] - 12.0) < 1e-9) { printf("pass [sequence fits small arena]\n"); pass++; }
+    else { printf("FAIL [sequence fits small arena: %s]\n", ks_strerror(small->last_status)); fail++; }
+    if (x) (k_free)(small, x);
+    ks_destroy(small);
+
+    /* values computed before a nested sequence survive its reclaim */
+    check_elem  ("outer operand kept", "(!4)+(+\\!4;2*!4)", 3, 9.0, 1e-9);
+    check_scalar("assigned in sequence", "(P: 3; P*2)+(Q: 4; Q+1)", 11.0, 1e-9);
+}
+
+static void test_shared_vars(void) {
+    printf("\n-- shared variable buffers --\n");
+    reset_vars();
+    run("A: !10");
+    run("B: A");
+    if (g_ctx->vars['B'-'A'] == g_ctx->vars['A'-'A']) { printf("pass [copy shares buffer]\n"); pass++; }
+    else { printf("FAIL [copy shares buffer]\n"); fail++; }
+
+    /* writing through one name leaves the other untouched */
+    run("A: A+1");
+    check_elem  ("writer sees new",  "A",   9, 10.0, 1e-9);
+    check_elem  ("sharer keeps old", "B",   9,  9.0, 1e-9);
+    check_elem  ("scan of var",      "+\\B", 9, 45.0, 1e-9);
+    check_elem  ("var after scan",   "B",   9,  9.0, 1e-9);
+
+    /* a host reference outlives reassignment */
+    K h = k_get(g_ctx, 'B');
+    run("B: 5");
+    if (h && h->n == 10 && h->f[9] == 9.0) { printf("pass [k_get survives reassign]\n"); pass++; }
+    else { printf("FAIL [k_get survives reassign]\n"); fail++; }
+    if (h && h->r == 1) { printf("pass [k_get sole owner]\n"); pass++; }
+    else { printf("FAIL [k_get sole owner]\n"); fail++; }
+    k_free(h);
+
+    /* a read taken before a failing statement does not pin the buffer */
+    run("C: !100");
+    run("C, !2000000");
+    K c = g_ctx->vars['C'-'A'];
+    if (c && c->r == 1) { printf("pass [count restored after error]\n"); pass++; }
+    else { printf("FAIL [count restored after error]\n"); fail++; }
+}
+
+static void test_arena_commit(void) {
+    printf("\n-- arena commit --\n");
+    ks_arena_stats s;
+    ks_ctx *ctx = ks_create(256u * 1024 * 1024, 0);
+    ks_arena_get_stats(ctx, &s);
+    if (s.reserved == 256u * 1024 * 1024 && s.committed < 4u * 1024 * 1024) { printf("pass [reserve is not commit]\n"); pass++; }
+    else { printf("FAIL [reserve is not commit: %zu]\n", s.committed); fail++; }
+
+    K x = ks_eval(ctx, "+\\!1000000", 11);
+    ks_arena_get_stats(ctx, &s);
+    if (x && x->n == 1000000 && s.committed >= 1000000 * sizeof(ks_real) && s.peak >= s.committed) { printf("pass [commit grows on demand]\n"); pass++; }
+    else { printf("FAIL [commit grows on demand: %zu]\n", s.committed); fail++; }
+    if (x) (k_free)(ctx, x);
+
+    ks_arena_keep(ctx, 0);
+    ks_arena_get_stats(ctx, &s);
+    if (s.committed < 1024 * 1024 && s.peak >= 1000000 * sizeof(ks_real)) { printf("pass [keep releases commit]\n"); pass++; }
+    else { printf("FAIL [keep releases commit: %zu]\n", s.committed); fail++; }
+    x = ks_eval(ctx, "+\\!1000", 8);
+    if (x && x->n == 1000 && x->f[999] == 499500.0) { printf("pass [eval after release]\n"); pass++; }
+    else { printf("FAIL [eval after release]\n"); fail++; }
+    if (x) (k_free)(ctx, x);
+    ks_destroy(ctx);
+
+    /* many large contexts side by side only pay for what they touch */
+    ks_ctx *many[32];
+    int ok = 1;
+    for (int i = 0; i < 32; i++) {
+        many[i] = ks_create(512u * 1024 * 1024, 0);
+        if (!many[i]) { ok = 0; continue; }
+        K y = ks_eval(many[i], "!100", 4);
+        if (!y || y->n != 100) ok = 0;
+        if (y) (k_free)(many[i], y);
+    }
+    for (int i = 0; i < 32; i++) ks_destroy(many[i]);
+    if (ok) { printf("pass [32 contexts of 512 MB]\n"); pass++; }
+    else { printf("FAIL [32 contexts of 512 MB]\n"); fail++; }
+}
+
+static void test_perm_pool(void) {
+    printf("\n-- perm pool --\n");
+    /* reassigning a var over and over cycles through a few recycled
+       buffers instead of allocating a new one every time */
+    ks_ctx *ctx = ks_create(1024 * 1024, 0);
+    K seen[8]; int nseen = 0, ok = 1;
+    K x = ks_eval(ctx, "H: !32", 6);
+    if (x) (k_free)(ctx, x);
+    for (int i = 0; i < 100; i++) {
+        x = ks_eval(ctx, "H: H+1", 6);
+        if (x) (k_free)(ctx, x);
+        K h = ctx->vars['H'-'A'];
+        int j = 0;
+        while (j < nseen && seen[j] != h) j++;
+        if (j == nseen) { if (nseen == 8) { ok = 0; break; } seen[nseen++] = h; }
+    }
+    if (ok && nseen <= 4) { printf("pass [reassign recycles buffers: %d]\n", nseen); pass++; }
+    else { printf("FAIL [reassign recycles buffers: %d]\n", nseen); fail++; }
+    K h = ctx->vars['H'-'A'];
+    if (h && h->n == 32 && h->f[31] == 131.0) { printf("pass [recycled value]\n"); pass++; }
+    else { printf("FAIL [recycled value]\n"); fail++; }
+
+    /* a different length takes a buffer from another class */
+    x = ks_eval(ctx, "H: 1 2 3", 8);
+    if (x) (k_free)(ctx, x);
+    h = ctx->vars['H'-'A'];
+    if (h && h->n == 3 && h->f[2] == 3.0) { printf("pass [shrink reassign]\n"); pass++; }
+    else { printf("FAIL [shrink reassign]\n"); fail++; }
+    ks_destroy(ctx);
+}
+
+static void test_dyadic_kernels(void) {
+    printf("\n-- dyadic kernels --\n");
+    /* lengths that leave a tail after the last full SIMD register */
+    check_elem  ("vec+scalar tail", "(!7)+10",      6, 16.0, 1e-9);
+    check_elem  ("scalar-vec tail", "10-!7",        6,  4.0, 1e-9);
+    check_elem  ("vec*vec tail",    "(!9)*!9",      8, 64.0, 1e-9);
+    check_elem  ("div by zero",     "(!5)%0 1 0 1 0", 3,  3.0, 1e-9);
+    check_elem  ("div zero lane",   "(!5)%0 1 0 1 0", 4,  0.0, 1e-9);
+    check_elem  ("min broadcast",   "(!9)&4",       8,  4.0, 1e-9);
+    check_elem  ("max broadcast",   "4|!9",         2,  4.0, 1e-9);
+    check_elem  ("less tail",       "(!7)<3",       2,  1.0, 1e-9);
+    check_elem  ("greater tail",    "(!7)>3",       6,  1.0, 1e-9);
+    check_elem  ("equal tail",      "(!7)=3",       3,  1.0, 1e-9);
+    /* the shorter side cycles in whole periods */
+    check_elem  ("cycle right",     "(!8)+1 2 3",   7, 9.0, 1e-9);
+    check_elem  ("cycle left",      "1 2 3+!8",     6, 7.0, 1e-9);
+    check_elem  ("cycle power",     "(1+!5)^2 1",   4, 25.0, 1e-9);
+}
+
+static void test_fast_accuracy(void) {
+    printf("\n-- fast accuracy mode --\n");
+    /* each verb over a range that crosses its reduction boundaries,
+       plus elements the fast kernels hand back to libm */
+    const char *src[] = {
+        "s 0.37*-500+!1000", "c 0.37*-500+!1000", "t 0.0013*-500+!1000",
+        "h 0.03*-500+!1000", "d 0.01*-500+!1000", "l 0.05*-500+!1000",
+        "e 0.3*-500+!1000",  "n 0.2*-200+!1000",  "s 1e7 0.5 -1e9 2",
+        "h 25 -30 0.5 0",    "e 150 -150 1 0"
+    };
+    ks_ctx *fast = ks_create(4 * 1024 * 1024, 0);
+    ks_set_accuracy(fast, KS_FAST);
+    for (size_t k = 0; k < sizeof src / sizeof *src; k++) {
+        K want = ks_eval(g_ctx, src[k], strlen(src[k]));
+        K got = ks_eval(fast, src[k], strlen(src[k]));
+        double maxrel = 0;
+        int ok = want && got && want->n == got->n;
+        for (int i = 0; ok && i < got->n; i++) {
+            double d = fabs(got->f[i] - want->f[i]) / (1.0 + fabs(want->f[i]));
+            if (d > maxrel) maxrel = d;
+        }
+        if (ok && maxrel <= TOL(1e-14, 0.0)) { printf("pass [fast %s, maxrel=%.1e]\n", src[k], maxrel); pass++; }
+        else { printf("FAIL [fast %s, maxrel=%.1e]\n", src[k], maxrel); fail++; }
+        k_free(want);
+        (k_free)(fast, got);
+    }
+
+    /* switching back drops values remembered in the fast mode */
+    const char *p = "A: s 0.1*!64; +A";
+    K f1 = ks_eval(fast, p, strlen(p));
+    ks_set_accuracy(fast, KS_EXACT);
+    K e1 = ks_eval(fast, p, strlen(p));
+    K e0 = ks_eval(g_ctx, p, strlen(p));
+    if (f1 && e1 && e0 && e1->f[0] == e0->f[0]) { printf("pass [exact again after fast]\n"); pass++; }
+    else { printf("FAIL [exact again after fast]\n"); fail++; }
+    (k_free)(fast, f1); (k_free)(fast, e1); k_free(e0);
+    ks_destroy(fast);
+}
+
+static void test_additive_recurrence(void) {
+    printf("\n-- additive recurrence --\n");
+    /* against the per-harmonic sum, with phases well past 2pi, a
+       phase past the fast sin range and negative/zero harmonics */
+    const char *src[] = {
+        "P: 0.37*!300; A: 1%1+!40; P $ A",
+        "P: 0.37*!300; P o 1 -2 0 3 3",
+        "P: 0.37*!300; P o 1.01 2.03 -3.1",
+        "P: 2e5 0.5 -3e6; P $ 1 0.5 0.25",
+        "P: 2e5 0.5 -3e6; P o 1.5 2"
+    };
+    for (size_t k = 0; k < sizeof src / sizeof *src; k++) {
+        int dollar = strchr(src[k], '$') != NULL;
+        K got = ks_eval(g_ctx, src[k], strlen(src[k]));
+        K p = k_get(g_ctx, 'P');
+        const char *h = strrchr(src[k], dollar ? '$' : 'o') + 2;
+        K hv = dollar && strchr(h, 'A') ? k_get(g_ctx, 'A') : ks_eval(g_ctx, h, strlen(h));
+        double maxdiff = 0;
+        int ok = got && p && hv && got->n == p->n;
+        for (int i = 0; ok && i < p->n; i++) {
+            double want = 0;
+            for (int j = 0; j < hv->n; j++)
+                want += dollar ? hv->f[j] * sin(p->f[i] * (j + 1)) : sin(p->f[i] * hv->f[j]);
+            double d = fabs(got->f[i] - want);
+            if (d > maxdiff) maxdiff = d;
+        }
+        if (ok && maxdiff < TOL(1e-11, 10.0)) { printf("pass [%s, maxdiff=%.1e]\n", src[k], maxdiff); pass++; }
+        else { printf("FAIL [%s, maxdiff=%.1e]\n", src[k], maxdiff); fail++; }
+        k_free(got); k_free(p); k_free(hv);
+    }
+    check_len   ("$ no harmonics", "(~8) $ !0", 8);
+    check_elem  ("$ no harmonics", "(~8) $ !0", 3, 0.0, 0.0);
+    check_elem  ("o no harmonics", "(~8) o !0", 5, 0.0, 0.0);
+}
+
+static void test_blocked_scan(void) {
+    printf("\n-- blocked scan --\n");
+    /* a million-step phase ramp does not drift (plain summation is
+       off by ~1e-6 here) */
+    check_elem  ("+\\ no drift", "+\\0.1+0*!1000000", 999999, 100000.0, 1e-9);
+    check_elem  ("+\\ segment edge", "+\\1+0*!9000", 4032, 4033.0, 0.0);
+    check_elem  ("&\\ across segments", "&\\(1000-!9000),5,7", 9001, -7999.0, 0.0);
+    check_elem  ("|\\ keeps first", "|\\(!9000)-5000", 10, -4990.0, 0.0);
+
+    /* same values whatever the thread count */
+    const char *src[] = {
+        "+\\s 0.37*!300000", "*\\1+0.000001*s 0.37*!300000",
+        "&\\s 0.37*!300000", "|\\s 0.37*!300000"
+    };
+    ks_ctx *par = ks_create(64 * 1024 * 1024, 0);
+    ks_set_threads(par, 4);
+    for (size_t k = 0; k < sizeof src / sizeof *src; k++) {
+        K one = ks_eval(g_ctx, src[k], strlen(src[k]));
+        K four = ks_eval(par, src[k], strlen(src[k]));
+        int same = one && four && one->n == four->n &&
+                   memcmp(one->f, four->f, one->n * sizeof one->f[0]) == 0;
+        if (same) { printf("pass [%s threads 1 == 4]\n", src[k]); pass++; }
+        else { printf("FAIL [%s threads 1 == 4]\n", src[k]); fail++; }
+        k_free(one);
+        (k_free)(par, four);
+    }
+    ks_destroy(par);
+}
+
+static void test_noise_seed(void) {
+    printf("\n-- noise seed --\n");
+    ks_seed(g_ctx, 7);
+    K a = run("r !4096");
+    ks_seed(g_ctx, 7);
+    K b = run("r !4096");
+    ks_seed(g_ctx, 8);
+    K c = run("r !4096");
+    if (!a || !b || !c) { printf("FAIL [noise seed]: NULL\n"); fail++; goto out; }
+    if (memcmp(a->f, b->f, a->n * sizeof a->f[0]) == 0) { printf("pass [same seed, same noise]\n"); pass++; }
+    else { printf("FAIL [same seed, same noise]\n"); fail++; }
+    if (memcmp(a->f, c->f, a->n * sizeof a->f[0]) != 0) { printf("pass [new seed, new noise]\n"); pass++; }
+    else { printf("FAIL [new seed, new noise]\n"); fail++; }
+    double mean = 0, lo = 1, hi = -1;
+    for (int i = 0; i < a->n; i++) {
+        mean += a->f[i];
+        if (a->f[i] < lo) lo = a->f[i];
+        if (a->f[i] > hi) hi = a->f[i];
+    }
+    mean /= a->n;
+    if (fabs(mean) < 0.05 && lo >= -1.0 && hi <= 1.0 && lo < -0.99 && hi > 0.99) { printf("pass [noise mean ~0, fills [-1,1]]\n"); pass++; }
+    else { printf("FAIL [noise spread]: mean %g lo %g hi %g\n", mean, lo, hi); fail++; }
+out:
+    if (a) k_free(a);
+    if (b) k_free(b);
+    if (c) k_free(c);
+
+    /* the stream carries on across calls */
+    ks_seed(g_ctx, 7);
+    K h1 = run("r !4");
+    K h2 = run("r !4");
+    ks_seed(g_ctx, 7);
+    K whole = run("r !8");
+    int cont = h1 && h2 && whole &&
+               memcmp(h1->f, whole->f, 4 * sizeof whole->f[0]) == 0 &&
+               memcmp(h2->f, whole->f + 4, 4 * sizeof whole->f[0]) == 0;
+    if (cont) { printf("pass [r !4, r !4 == r !8]\n"); pass++; }
+    else { printf("FAIL [r !4, r !4 == r !8]\n"); fail++; }
+    if (h1) k_free(h1);
+    if (h2) k_free(h2);
+    if (whole) k_free(whole);
+
+    /* each context has its own stream */
+    ks_ctx *other = ks_create(16 * 1024 * 1024, 0);
+    ks_seed(g_ctx, 0);
+    K mine = run("r !16");
+    K theirs = ks_eval(other, "r !16", 5);
+    if (mine && theirs && memcmp(mine->f, theirs->f, 16 * sizeof mine->f[0]) == 0) { printf("pass [contexts share no noise state]\n"); pass++; }
+    else { printf("FAIL [contexts share no noise state]\n"); fail++; }
+    if (mine) k_free(mine);
+    if (theirs) (k_free)(other, theirs);
+    ks_destroy(other);
+}
+
+static void test_buzz_accumulator(void) {
+    printf("\n-- buzz phase accumulators --\n");
+    static const double ff[] = {2.43, 3.01, 3.52, 4.11, 5.23, 6.78};
+    check_elem  ("b starts low", "b !8", 0, -1.0, 0.0);
+
+    /* the sign-of-sin cluster, but for samples on a crossing */
+    K x = run("440 b !44100");
+    if (!x) { printf("FAIL [440 b]: NULL\n"); fail++; return; }
+    int off = 0;
+    for (int i = 0; i < x->n; i++) {
+        double ss = 0;
+        for (int j = 0; j < 6; j++)
+            ss += (sin(i * (440.0 * 2.0 * M_PI / 44100.0) * ff[j]) > 0) ? 1.0 : -1.0;
+        if (fabs(x->f[i] - ss / 6.0) > TOL(1e-12, 1.0)) off++;
+    }
+    if (off <= 4) { printf("pass [440 b matches sin signs (%d on crossings)]\n", off); pass++; }
+    else { printf("FAIL [440 b matches sin signs]: %d samples differ\n", off); fail++; }
+
+    /* PolyBLEP stays in range and only touches samples near edges */
+    K bl = run("(55,1) b !44100");
+    K nv = run("55 b !44100");
+    if (!bl || !nv) { printf("FAIL [(55,1) b]: NULL\n"); fail++; }
+    else {
+        int same = 0, in = 1;
+        for (int i = 0; i < bl->n; i++) {
+            if (bl->f[i] == nv->f[i]) same++;
+            if (bl->f[i] < -1.0 || bl->f[i] > 1.0) in = 0;
+        }
+        if (in && same > bl->n * 8 / 10 && same < bl->n) { printf("pass [PolyBLEP buzz (%d of %d untouched)]\n", same, bl->n); pass++; }
+        else { printf("FAIL [PolyBLEP buzz]: in range %d, %d of %d untouched\n", in, same, bl->n); fail++; }
+    }
+    k_free(x);
+    if (bl) k_free(bl);
+    if (nv) k_free(nv);
+    check_elem  ("PolyBLEP drops partials above Nyquist", "|\\a (20000,1) b !100", 99, 0.0, 0.0);
+}
+
+static void test_wavetable_mips(void) {
+    printf("\n-- wavetable mip levels --\n");
+    reset_vars();
+    run("T: s ~256");
+    K tb = run("T");
+
+    /* pitches that cannot alias read the table as before */
+    K x = run("T t 100 1000");
+    if (!tb || !x) { printf("FAIL [t low pitch]: NULL\n"); fail++; }
+    else {
+        double phase = 0, inc = 100.0 * 256 / 44100.0, err = 0;
+        for (int i = 0; i < x->n; i++) {
+            while (phase >= 256) phase -= 256;
+            int idx = (int)phase;
+            double fr = phase - idx;
+            double want = tb->f[idx] * (1.0 - fr) + tb->f[(idx + 1) % 256] * fr;
+            if (fabs(x->f[i] - want) > err) err = fabs(x->f[i] - want);
+            phase += inc;
+        }
+        if (err <= TOL(1e-12, 1.0)) { printf("pass [t below Nyquist unchanged]: %.3g\n", err); pass++; }
+        else { printf("FAIL [t below Nyquist unchanged]: %.3g\n", err); fail++; }
+    }
+    if (x) k_free(x);
+    if (tb) k_free(tb);
+
+    /* a fundamental survives high up; a 7th harmonic past Nyquist goes */
+    double errs[3] = {0, 0, 0};
+    const char *src[3] = {"T t 5000 4410", "T t -3000 4410", "T t 15000 4410"};
+    const double hz[3] = {5000, -3000, 15000};
+    for (int k = 0; k < 3; k++) {
+        K y = run(src[k]);
+        if (!y) { errs[k] = 1; continue; }
+        for (int i = 0; i < y->n; i++) {
+            double e = fabs(y->f[i] - sin(2.0 * M_PI * hz[k] * i / 44100.0));
+            if (e > errs[k]) errs[k] = e;
+        }
+        k_free(y);
+    }
+    for (int k = 0; k < 3; k++) {
+        if (errs[k] < 1e-5) { printf("pass [%s tracks sin]: %.3g\n", src[k], errs[k]); pass++; }
+        else { printf("FAIL [%s tracks sin]: %.3g\n", src[k], errs[k]); fail++; }
+    }
+
+    /* a long table loses nothing at ordinary pitches, power of two
+       or not */
+    const char *big[6] = {"T t 100 4410", "T t 440 4410", "T t 3000 4410",
+                          "U t 100 4410", "U t 440 4410", "U t 3000 4410"};
+    const double bhz[6] = {100, 440, 3000, 100, 440, 3000};
+    run("T: s ~2048");
+    run("U: s ~3000");
+    for (int k = 0; k < 6; k++) {
+        K y = run(big[k]);
+        double e = y ? 0 : 1;
+        for (int i = 0; y && i < y->n; i++) {
+            double d = fabs(y->f[i] - sin(2.0 * M_PI * bhz[k] * i / 44100.0));
+            if (d > e) e = d;
+        }
+        if (y) k_free(y);
+        if (e < 1e-5) { printf("pass [long %s tracks sin]: %.3g\n", big[k], e); pass++; }
+        else { printf("FAIL [long %s tracks sin]: %.3g\n", big[k], e); fail++; }
+    }
+    run("T: s 7*~256");
+    check_elem  ("t drops harmonics past Nyquist", "|\\a T t 5000 4410", 4409, 0.0, 1e-3);
+    check_elem  ("t keeps harmonics below Nyquist", "|\\a T t 1000 4410", 4409, 1.0, 1e-2);
+
+    /* cubic reads a coarse table more closely than linear */
+    run("T: s ~32");
+    double el = 0, ec = 0;
+    K lin = run("T t 441 4410");
+    K cub = run("T t 441 4410 1");
+    if (lin && cub) {
+        for (int i = 0; i < lin->n; i++) {
+            double want = sin(2.0 * M_PI * 441.0 * i / 44100.0);
+            if (fabs(lin->f[i] - want) > el) el = fabs(lin->f[i] - want);
+            if (fabs(cub->f[i] - want) > ec) ec = fabs(cub->f[i] - want);
+        }
+    }
+    if (lin && cub && ec < el / 4) { printf("pass [cubic t]: %.3g vs linear %.3g\n", ec, el); pass++; }
+    else { printf("FAIL [cubic t]: %.3g vs linear %.3g\n", ec, el); fail++; }
+    if (lin) k_free(lin);
+    if (cub) k_free(cub);
+    reset_vars();
+}
+
+static void test_filter_lanes(void) {
+    printf("\n-- filter lanes --\n");
+    reset_vars();
+    run("A: s 0.05*!1001");
+    run("B: r !1001");
+    run("C: (!1001)%1001");
+    run("D: 0.5*s 0.3*!1001");
+    run("V: (A z B) z (C z D)");   /* frames of a c b d */
+    const char *lanes[2] = {"0.2 0 4 f V", "900 0.8 4 g V"};
+    const char *alone[2][4] = {
+        {"0.2 f A", "0.2 f C", "0.2 f B", "0.2 f D"},
+        {"900 0.8 g A", "900 0.8 g C", "900 0.8 g B", "900 0.8 g D"}
+    };
+    for (int k = 0; k < 2; k++) {
+        K x = run(lanes[k]);
+        int same = x && x->n == 4 * 1001;
+        for (int l = 0; l < 4 && same; l++) {
+            K y = run(alone[k][l]);
+            for (int i = 0; y && i < y->n; i++) if (x->f[4 * i + l] != y->f[i]) { same = 0; break; }
+            if (!y) same = 0; else k_free(y);
+        }
+        if (same) { printf("pass [%s == each lane alone]\n", lanes[k]); pass++; }
+        else { printf("FAIL [%s == each lane alone]\n", lanes[k]); fail++; }
+        if (x) k_free(x);
+    }
+
+    /* a partial last frame and more than KS_FILT_LANES lanes */
+    run("W: s 0.01*!103");
+    K x = run("0.3 0 10 f W");
+    int same = x && x->n == 103;
+    for (int l = 0; l < 10 && same; l++) {
+        double b0 = 0, b1 = 0;
+        for (int i = l; i < 103; i += 10) {
+            b0 += 0.3 * (sin(0.01 * i) - b0); b1 += 0.3 * (b0 - b1);
+            if (fabs(x->f[i] - b1) > TOL(1e-12, 1.0)) { same = 0; break; }
+        }
+    }
+    if (same) { printf("pass [10 lanes, partial frame]\n"); pass++; }
+    else { printf("FAIL [10 lanes, partial frame]\n"); fail++; }
+    if (x) k_free(x);
+    reset_vars();
+}
+
+static void test_svf_control_rate(void) {
+    printf("\n-- g control rate --\n");
+    reset_vars();
+    run("S: r !20000");
+    run("M: 100+5000*e 0-0.0003*!20000");
+    K exact = run("M g S");   /* M[1] doubles as Q: barely damped */
+    ks_set_control_rate(g_ctx, 32);
+    K ctl = run("M g S");
+    K fixed = run("800 0.7 g S");
+    ks_set_control_rate(g_ctx, 1);
+    K fixed1 = run("800 0.7 g S");
+    K again = run("M g S");
+    if (!exact || !ctl || !fixed || !fixed1 || !again) { printf("FAIL [g control rate]: NULL\n"); fail++; }
+    else {
+        double err = 0, peak = 0;
+        for (int i = 0; i < exact->n; i++) {
+            if (fabs(ctl->f[i] - exact->f[i]) > err) err = fabs(ctl->f[i] - exact->f[i]);
+            if (fabs(exact->f[i]) > peak) peak = fabs(exact->f[i]);
+        }
+        if (err < 1e-2 * peak && err > 0) { printf("pass [g every 32 samples]: %.3g of %.3g\n", err, peak); pass++; }
+        else { printf("FAIL [g every 32 samples]: %.3g of %.3g\n", err, peak); fail++; }
+        if (memcmp(fixed->f, fixed1->f, fixed->n * sizeof fixed->f[0]) == 0) { printf("pass [fixed cutoff ignores control rate]\n"); pass++; }
+        else { printf("FAIL [fixed cutoff ignores control rate]\n"); fail++; }
+        if (memcmp(exact->f, again->f, exact->n * sizeof exact->f[0]) == 0) { printf("pass [control rate 1 is exact again]\n"); pass++; }
+        else { printf("FAIL [control rate 1 is exact again]\n"); fail++; }
+    }
+    if (exact) k_free(exact);
+    if (ctl) k_free(ctl);
+    if (fixed) k_free(fixed);
+    if (fixed1) k_free(fixed1);
+    if (again) k_free(again);
+
+    /* a sweep past Nyquist and back folds through the table as sin does */
+    run("M: 44100*(s 0.001*!2000)");
+    run("S: s 0.2*!2000");
+    K e2 = run("M 2 g S");
+    ks_set_control_rate(g_ctx, 1000);
+    K c2 = run("M 2 g S");
+    ks_set_control_rate(g_ctx, 1);
+    int finite = c2 && e2 && c2->n == e2->n;
+    for (int i = 0; finite && i < c2->n; i++) if (!isfinite(c2->f[i])) finite = 0;
+    if (finite) { printf("pass [control rate folds high cutoffs]\n"); pass++; }
+    else { printf("FAIL [control rate folds high cutoffs]\n"); fail++; }
+    if (e2) k_free(e2);
+    if (c2) k_free(c2);
+    reset_vars();
+}
+
+static void test_delay_taps(void) {
+    printf("\n-- delay blocks and taps --\n");
+    reset_vars();
+    run("S: r !3000");
+    K in = run("S");
+    const char *src[] = {"300 0.9 y S", "17 0.7 y S", "5 0.5 y S", "2999 0.5 y S"};
+    const int dd[] = {300, 17, 5, 2999};
+    const double gg[] = {0.9, 0.7, 0.5, 0.5};
+    for (int k = 0; in && k < 4; k++) {
+        K x = run(src[k]);
+        double want[3000];
+        int same = x && x->n == 3000;
+        for (int i = 0; same && i < 3000; i++) {
+            want[i] = in->f[i] + gg[k] * (i >= dd[k] ? want[i - dd[k]] : 0.0);
+            if (fabs(x->f[i] - want[i]) > TOL(1e-12, 1.0)) same = 0;
+        }
+        if (same) { printf("pass [%s]\n", src[k]); pass++; }
+        else { printf("FAIL [%s]\n", src[k]); fail++; }
+        if (x) k_free(x);
+    }
+
+    /* several taps, fractional delays read between samples */
+    K x = run("300 0.4 451.5 0.3 37.25 0.2 y S");
+    const double td[] = {300, 451.5, 37.25}, tg[] = {0.4, 0.3, 0.2};
+    double want[3000];
+    int same = in && x && x->n == 3000;
+    for (int i = 0; same && i < 3000; i++) {
+        want[i] = in->f[i];
+        for (int t = 0; t < 3; t++) {
+            int d = (int)td[t];
+            double fr = td[t] - d;
+            double a0 = i - d >= 0 ? want[i - d] : 0.0, a1 = i - d - 1 >= 0 ? want[i - d - 1] : 0.0;
+            want[i] += tg[t] * ((1.0 - fr) * a0 + fr * a1);
+        }
+        if (fabs(x->f[i] - want[i]) > TOL(1e-12, 1.0)) same = 0;
+    }
+    if (same) { printf("pass [three taps, fractional]\n"); pass++; }
+    else { printf("FAIL [three taps, fractional]\n"); fail++; }
+    if (x) k_free(x);
+    if (in) k_free(in);
+
+    check_elem  ("delay below 1 is 1", "0 0.5 y 1 1 1", 2, 1.75, 1e-12);
+    check_elem  ("y clamps runaway feedback", "1 2 y 100#1", 99, 1e6, 0.0);
+    reset_vars();
+}
+
+static void test_nan_policy(void) {
+    printf("\n-- NaN policy --\n");
+    reset_vars();
+    run("S: r !5000");
+    run("M: 100+!5000");
+    /* a filter that never runs away gives the same samples under every policy */
+    const char *src[] = {"400 0.7 g S", "0.1 1 f S", "0.1 1 3 f S", "400 0.7 3 g S",
+                         "M g S", "2 0.5 y S", "300 0.5 y S", "2 0.3 5.5 0.3 y S"};
+    for (int k = 0; k < 8; k++) {
+        K want = run(src[k]);
+        int same = want != NULL;
+        for (int pol = KS_NAN_BLOCK; same && pol <= KS_NAN_OUTPUT; pol++) {
+            ks_set_nan_policy(g_ctx, pol);
+            K x = run(src[k]);
+            same = x && x->n == want->n && memcmp(x->f, want->f, x->n * sizeof x->f[0]) == 0;
+            if (x) k_free(x);
+        }
+        ks_set_nan_policy(g_ctx, KS_NAN_SAMPLE);
+        if (same) { printf("pass [%s, all policies]\n", src[k]); pass++; }
+        else { printf("FAIL [%s, all policies]\n", src[k]); fail++; }
+        if (want) k_free(want);
+    }
+
+    /* runaway feedback: every policy keeps the output finite and in range */
+    const char *wild[] = {"1 2 y 2000#1", "1 2 0.5 1.5 y 2000#1", "0.9 3.98 f 1e300*r !2000", "20000 0.01 g 1e300*r !2000"};
+    for (int k = 0; k < 4; k++)
+        for (int pol = KS_NAN_SAMPLE; pol <= KS_NAN_OUTPUT; pol++) {
+            ks_set_nan_policy(g_ctx, pol);
+            K x = run(wild[k]);
+            int ok = x && x->n == 2000;
+            for (int i = 0; ok && i < x->n; i++) if (!(fabs(x->f[i]) <= 1e6)) ok = 0;
+            if (ok) { printf("pass [%s, policy %d]\n", wild[k], pol); pass++; }
+            else { printf("FAIL [%s, policy %d]\n", wild[k], pol); fail++; }
+            if (x) k_free(x);
+        }
+    ks_set_nan_policy(g_ctx, KS_NAN_SAMPLE);
+    check_elem  ("per-sample clamp holds at 1e6", "1 2 y 2000#1", 1999, 1e6, 0.0);
+    ks_set_nan_policy(g_ctx, KS_NAN_OUTPUT);
+    check_elem  ("output clamp zeroes overflow", "1 2 y 2000#1", 1999, 0.0, 0.0);
+    ks_set_nan_policy(g_ctx, (ks_nan_policy)7);
+    check_elem  ("unknown policy is per-sample", "1 2 y 2000#1", 1999, 1e6, 0.0);
+    ks_set_nan_policy(g_ctx, KS_NAN_SAMPLE);
+    reset_vars();
+}
+
+static K k_clone_vals(K x) {
+    K c = malloc(sizeof(*c) + (x->n > 0 ? x->n : 0) * sizeof x->f[0]);
+    c->r = 1; c->n = x->n;
+    if (x->n > 0) memcpy(c->f, x->f, x->n * sizeof x->f[0]);
+    return c;
+}
+
+/* Variables, value and status of src run on a context with n threads;
+   returns whether helper contexts ran any of it. */
+static int run_threads(const char *src, int threads, int rerun, K *vars, K *out, ks_status *st) {
+    int runs = rerun ? 3 : 2;
+    ks_ctx *c = ks_create(0, 0);
+    ks_set_threads(c, threads);
+    ks_program *prog = ks_compile(src, strlen(src));
+    /* the first run teaches which statements are worth a thread; a
+       rerun then starts from cleared vars and ends with nothing to do */
+    K x = ks_program_run(c, prog);
+    for (int r = 1; r < runs; r++) {
+        if (x) (k_free)(c, x);
+        if (rerun && r == 1) ks_clear_vars(c);
+        x = rerun ? ks_program_rerun(c, prog) : ks_program_run(c, prog);
+    }
+    int helped = c->helpers != NULL;
+    *st = c->last_status;
+    *out = x ? k_clone_vals(x) : NULL;
+    for (int i = 0; i < 26; i++) vars[i] = c->vars[i] ? k_clone_vals(c->vars[i]) : NULL;
+    if (x) (k_free)(c, x);
+    ks_program_free(prog);
+    ks_destroy(c);
+    return helped;
+}
+
+static int same_vals(K a, K b) {
+    if (!a || !b) return a == b;
+    return a->n == b->n && memcmp(a->f, b->f, a->n * sizeof a->f[0]) == 0;
+}
+
+static void test_parallel_statements(void) {
+    printf("\n-- statements side by side --\n");
+    const char *src[] = {
+        /* bell.ks: partials that read nothing of each other */
+        "N: 52920\nT: !N\nE: e(T*(0-6.9%N))\n"
+        "F: 440*(6.28318%44100)\nG: 1213*(6.28318%44100)\n"
+        "J: 2378*(6.28318%44100)\nK: 3930*(6.28318%44100)\n"
+        "P: +\\(N#F)\nQ: +\\(N#G)\nR: +\\(N#J)\nS: +\\(N#K)\n"
+        "A: (s P)*e(T*(0-6.9%N))\nB: (s Q)*e(T*(0-10%N))\n"
+        "C: (s R)*e(T*(0-15%N))\nD: (s S)*e(T*(0-22%N))\n"
+        "W: w (A*.9)+(B*.6)+(C*.3)+(D*.15)",
+        /* noise draws in script order; B reads A before A is rewritten */
+        "A: r !70000\nC: 0.2 f r !70000\nB: A*2\nA: 7\nD: r !10\nE: A+B",
+        /* a failure keeps what ran before it and nothing after */
+        "A: !50000\nB: s !60000\nC: !2000000\nD: 1+!70000\nE: 9",
+        /* each assignment happens once, in script order */
+        "A: !70000\nB: 2+!70000;C: A\nA: 5\nD: (B: s !70000)+A",
+    };
+    for (size_t k = 0; k < sizeof src / sizeof *src; k++)
+        for (int rerun = 0; rerun <= 1; rerun++) {
+            K v1[26], v4[26], o1, o4;
+            ks_status s1, s4;
+            run_threads(src[k], 1, rerun, v1, &o1, &s1);
+            int helped = run_threads(src[k], 4, rerun, v4, &o4, &s4);
+            int same = helped && s1 == s4 && same_vals(o1, o4);
+            for (int i = 0; i < 26; i++) {
+                if (!same_vals(v1[i], v4[i])) same = 0;
+                free(v1[i]); free(v4[i]);
+            }
+            free(o1); free(o4);
+            if (same) { printf("pass [script %d, %s, threads 1 == 4]\n", (int)k, rerun ? "rerun" : "run"); pass++; }
+            else { printf("FAIL [script %d, %s, threads 1 == 4]\n", (int)k, rerun ? "rerun" : "run"); fail++; }
+        }
+}
+
+static void test_parallel_kernels(void) {
+    printf("\n-- kernels split across threads --\n");
+    /* element-wise chains, verbs and reductions give the same values
+       whatever the thread count */
+    const char *src[] = {
+        "(s 0.01*!300000)*e 0-0.00001*!300000", "h 3*c 0.02*!300001",
+        "w (s 0.37*!250000)*3", "+s 0.37*!300000", ">s 0.37*!300000",
+        "(1+!200000)%(2+!200000)", "(!100000),+(!70000)"
+    };
+    ks_ctx *par = ks_create(64 * 1024 * 1024, 0);
+    ks_set_threads(par, 4);
+    ks_set_par_min(par, 1000);
+    for (int acc = 0; acc < 2; acc++) {
+        ks_set_accuracy(g_ctx, acc ? KS_FAST : KS_EXACT);
+        ks_set_accuracy(par, acc ? KS_FAST : KS_EXACT);
+        for (size_t k = 0; k < sizeof src / sizeof *src; k++) {
+            K one = ks_eval(g_ctx, src[k], strlen(src[k]));
+            K four = ks_eval(par, src[k], strlen(src[k]));
+            int same = one && four && one->n == four->n &&
+                       memcmp(one->f, four->f, one->n * sizeof one->f[0]) == 0;
+            if (same) { printf("pass [%s threads 1 == 4%s]\n", src[k], acc ? ", fast" : ""); pass++; }
+            else { printf("FAIL [%s threads 1 == 4%s]\n", src[k], acc ? ", fast" : ""); fail++; }
+            k_free(one);
+            (k_free)(par, four);
+        }
+    }
+    ks_set_accuracy(g_ctx, KS_EXACT);
+    ks_destroy(par);
+
+    /* running out of gas after a split leaves the workers usable */
+    par = ks_create(64 * 1024 * 1024, 1000000);
+    ks_set_threads(par, 4);
+    ks_set_par_min(par, 1000);
+    K x = ks_eval(par, "+s 0.1*!300000", 14);
+    if (!x && par->last_status == KS_ERR_GAS) { printf("pass [gas after a split]\n"); pass++; }
+    else { printf("FAIL [gas after a split]\n"); fail++; }
+    if (x) (k_free)(par, x);
+    x = ks_eval(par, "+s 0.1*!200000", 14);
+    K y = ks_eval(g_ctx, "+s 0.1*!200000", 14);
+    if (x && y && x->f[0] == y->f[0]) { printf("pass [split after gas]\n"); pass++; }
+    else { printf("FAIL [split after gas]\n"); fail++; }
+    if (x) (k_free)(par, x);
+    k_free(y);
+    ks_destroy(par);
+}
+
 int main(void) {
     printf("ksynth test suite\n");
     printf("=================\n");
@@ -963,6 +1957,30 @@ int main(void) {
     test_rise_decay_envelope();
     test_1bit_noise();
     test_host_array_helpers();
+    test_compiled_program();
+    test_function_cache();
+    test_fused_chain();
+    test_lazy_generators();
+    test_fold_and_cse();
+    test_incremental_rerun();
+    test_inplace_temporaries();
+    test_statement_reclaim();
+    test_shared_vars();
+    test_arena_commit();
+    test_perm_pool();
+    test_dyadic_kernels();
+    test_fast_accuracy();
+    test_additive_recurrence();
+    test_blocked_scan();
+    test_noise_seed();
+    test_buzz_accumulator();
+    test_wavetable_mips();
+    test_filter_lanes();
+    test_svf_control_rate();
+    test_delay_taps();
+    test_nan_policy();
+    test_parallel_statements();
+    test_parallel_kernels();
 
     printf("\n=================\n");
     printf("passed: %d  failed: %d\n", pass, fail);